@@ -0,0 +1,85 @@
+#include "AdmissionControl.hpp"
+#include <algorithm>
+#include <cmath>
+
+AdmissionControl::AdmissionControl()
+	: AdmissionControl(Options())
+{
+	;
+}
+
+AdmissionControl::AdmissionControl(Options options)
+	: options{ options }
+{
+	;
+}
+
+AdmissionControl::Decision AdmissionControl::admit(uint64_t key, size_t cost, size_t nowMs) {
+	if (shed(cost, nowMs)) {
+		overloadedCnt.fetch_add(1, std::memory_order_relaxed);
+		return { Verdict::Overloaded, 1 };
+	}
+	if (key != AnonymousKey) {
+		Shard& shard = shards[key % Shards];
+		std::unique_lock<std::mutex> lck{ shard.mtx };
+		if (shard.buckets.size() >= MaxBucketsPerShard) {
+			evictIdle(shard, nowMs);
+		}
+		auto [iter, inserted] = shard.buckets.try_emplace(key, Bucket{ options.burst, nowMs });
+		if (size_t retryAfterSec = spend(iter->second, cost, nowMs); retryAfterSec) {
+			rateLimitedCnt.fetch_add(1, std::memory_order_relaxed);
+			return { Verdict::RateLimited, retryAfterSec };
+		}
+	}
+	admittedCnt.fetch_add(1, std::memory_order_relaxed);
+	return {};
+}
+
+bool AdmissionControl::shed(size_t cost, size_t nowMs) {
+	if ((cost <= options.cheapCost) || (latencyMcs.load(std::memory_order_relaxed) <= options.targetLatencyMcs)) {
+		return false;
+	}
+	// the only request of interval that wins the exchange goes through as probe
+	size_t probeMs = nextProbeMs.load(std::memory_order_relaxed);
+	return (nowMs < probeMs) || !nextProbeMs.compare_exchange_strong(probeMs, nowMs + options.probeIntervalMs, std::memory_order_relaxed);
+}
+
+size_t AdmissionControl::spend(Bucket& bucket, size_t cost, size_t nowMs) const {
+	bucket.tokens = tokensAt(bucket, nowMs);
+	bucket.lastMs = std::max(bucket.lastMs, nowMs);
+	if (bucket.tokens < (double)cost) {
+		double missing = (double)cost - bucket.tokens;
+		return std::max<size_t>((size_t)std::ceil(missing / options.rate), 1);
+	}
+	bucket.tokens -= (double)cost;
+	return 0;
+}
+
+void AdmissionControl::done(size_t latency) {
+	size_t cur = latencyMcs.load(std::memory_order_relaxed);
+	size_t next = 0;
+	do {
+		next = cur - cur / 16 + latency / 16;
+	} while (!latencyMcs.compare_exchange_weak(cur, next, std::memory_order_relaxed));
+}
+
+AdmissionControl::Stats AdmissionControl::stats() const {
+	Stats res;
+	res.admitted = admittedCnt.load(std::memory_order_relaxed);
+	res.rateLimited = rateLimitedCnt.load(std::memory_order_relaxed);
+	res.overloaded = overloadedCnt.load(std::memory_order_relaxed);
+	res.latencyMcs = latencyMcs.load(std::memory_order_relaxed);
+	return res;
+}
+
+double AdmissionControl::tokensAt(const Bucket& bucket, size_t nowMs) const {
+	if (nowMs <= bucket.lastMs) {
+		return bucket.tokens;
+	}
+	return std::min(options.burst, bucket.tokens + (double)(nowMs - bucket.lastMs) * options.rate / 1000.0);
+}
+
+void AdmissionControl::evictIdle(Shard& shard, size_t nowMs) const {
+	// full bucket is the same as absent one
+	std::erase_if(shard.buckets, [this, nowMs](const auto& entry) { return tokensAt(entry.second, nowMs) >= options.burst; });
+}
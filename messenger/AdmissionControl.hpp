@@ -0,0 +1,96 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+/*
+	Admission control in front of route handlers.
+	Every authenticated user has token bucket, routes spend tokens according to their cost.
+	Requests without authentication can't be told apart (peer address is not known, proxy headers are set
+	by client itself), shared bucket would let one client lock everybody out of login, so they are not rate limited,
+	only shed on overload.
+	Buckets are kept in sharded table, idle full buckets are evicted when shard grows.
+	Independently, overload is detected by moving average of handler latency:
+	while it is above target, only cheap requests (cost <= CheapCost) are admitted,
+	so cached reads stay fast while heavy ones are shed. One heavy request per probe interval is still admitted,
+	so average keeps following real latency when only heavy requests arrive.
+*/
+class AdmissionControl {
+public:
+	enum class Verdict {
+		Admit,
+		// client exceeded its rate, 429
+		RateLimited,
+		// server is overloaded, 503
+		Overloaded
+	};
+
+	struct Decision {
+		Verdict verdict = Verdict::Admit;
+		size_t retryAfterSec = 0;
+	};
+
+	struct Options {
+		// tokens per second refilled to every bucket
+		double rate = 20;
+		// bucket capacity
+		double burst = 40;
+		// handler latency above which server is overloaded
+		size_t targetLatencyMcs = 100000;
+		// requests of this cost and cheaper are never shed
+		size_t cheapCost = 1;
+		// heavy request admitted while overloaded to measure latency
+		size_t probeIntervalMs = 100;
+	};
+
+	struct Stats {
+		size_t admitted = 0;
+		size_t rateLimited = 0;
+		size_t overloaded = 0;
+		size_t latencyMcs = 0;
+	};
+
+	static constexpr size_t Shards = 64;
+	static constexpr size_t MaxBucketsPerShard = 4096;
+	// user ids start from 1
+	static constexpr uint64_t AnonymousKey = 0;
+
+	AdmissionControl();
+	explicit AdmissionControl(Options options);
+
+	// key is user id, AnonymousKey for unauthenticated requests, which are only shed
+	Decision admit(uint64_t key, size_t cost, size_t nowMs);
+	// reports handler latency of admitted request
+	void done(size_t latencyMcs);
+	Stats stats() const;
+
+private:
+	struct Bucket {
+		double tokens = 0;
+		size_t lastMs = 0;
+	};
+
+	struct alignas(64) Shard {
+		std::mutex mtx;
+		std::unordered_map<uint64_t, Bucket> buckets;
+	};
+
+	double tokensAt(const Bucket& bucket, size_t nowMs) const;
+	// returns seconds to wait if bucket has not enough tokens, else spends them and returns 0
+	size_t spend(Bucket& bucket, size_t cost, size_t nowMs) const;
+	void evictIdle(Shard& shard, size_t nowMs) const;
+	// true if request of this cost is shed
+	bool shed(size_t cost, size_t nowMs);
+
+	const Options options;
+	std::array<Shard, Shards> shards;
+	// moving average with 1/16 weight
+	std::atomic<size_t> latencyMcs{ 0 };
+	std::atomic<size_t> nextProbeMs{ 0 };
+	std::atomic<size_t> admittedCnt{ 0 };
+	std::atomic<size_t> rateLimitedCnt{ 0 };
+	std::atomic<size_t> overloadedCnt{ 0 };
+};
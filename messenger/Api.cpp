@@ -1,8 +1,13 @@
 #include "Api.hpp"
 #include <format>
-#include "ProjLogger.hpp"
+#include <array>
+#include <charconv>
+#include <string_view>
+#include "AsyncLog.hpp"
+#include "RequestArena.hpp"
+#include "Metrics.hpp"
+#include "Tracing.hpp"
 #include "profiling.hpp"
-#include "EventBroker.hpp"
 
 using namespace util::web::http;
 using namespace util::web::json;
@@ -10,10 +15,165 @@ using namespace util::crypto;
 using namespace util::prof;
 using namespace db;
 
-#define NotAuthGuard size_t userId = 0; bool auth = false; if (std::tie(auth, userId) = userIsAuthenticated(request); !auth) return response(request, 403);
+namespace {
 
-Api::Api(std::unique_ptr<db::MessengerDb> pdb)
-    : db{std::move(pdb)}
+    using Handler = util::web::http::HttpResponse(Api::*)(const util::web::http::HttpRequest&, HttpServer::CallbackMsgFn, size_t);
+
+    struct Route {
+        const char* path;
+        Method method;
+        Handler handler;
+        // tokens spent from client's rate limit bucket, 0 - not limited, 1 - cheap (served from cache)
+        size_t cost;
+    };
+
+    // all api routes in one place, registered in this order, overlapping wildcards are resolved by resolveRoute()
+    const std::array Routes{
+        // test - TODO delete
+        Route{ "/echo", Method::GET, &Api::echo, 1 },
+        Route{ "/hello", Method::GET, &Api::hello, 1 },
+
+        Route{ "/*", Method::OPTIONS, &Api::onOptions, 0 },
+        Route{ "/user/find*", Method::GET, &Api::userFind, 1 },
+        Route{ "/user/login", Method::POST, &Api::userRegisterOrLogin, 4 },
+        Route{ "/user/logout", Method::POST, &Api::userLogout, 1 },
+        Route{ "/contact", Method::POST, &Api::contactAdd, 2 },
+        Route{ "/contact", Method::GET, &Api::contactsGetForId, 1 },
+        Route{ "/contact", Method::DELETE, &Api::contactDelete, 2 },
+        Route{ "/chat", Method::POST, &Api::chatAdd, 2 },
+        Route{ "/chat", Method::GET, &Api::chatsGetForId, 1 },
+        Route{ "/chat", Method::DELETE, &Api::chatDelete, 2 },
+        Route{ "/chat/group", Method::POST, &Api::chatGroupAdd, 2 },
+        Route{ "/chat/member", Method::POST, &Api::chatMemberAdd, 2 },
+        Route{ "/chat/member*", Method::GET, &Api::chatMembersGet, 1 },
+        Route{ "/chat/member", Method::DELETE, &Api::chatMemberDelete, 2 },
+        Route{ "/message", Method::POST, &Api::txtMessageAdd, 2 },
+        Route{ "/message/search*", Method::GET, &Api::messageSearch, 4 },
+        Route{ "/message*", Method::GET, &Api::txtMessagesGetForChatId, 2 },
+        Route{ "/storage*", Method::GET, &Api::storageGet, 4 },
+        Route{ "/storage", Method::POST, &Api::storageUpload, 4 },
+        Route{ "/events", Method::GET, &Api::eventsSubscribe, 1 },
+        Route{ "/batch", Method::POST, &Api::batch, 4 },
+        Route{ "/bootstrap", Method::GET, &Api::bootstrap, 4 },
+        Route{ "/sync*", Method::GET, &Api::sync, 2 },
+    };
+
+    // ops in one /batch request
+    constexpr size_t MaxBatchOps = 64;
+    // messages per chat returned by /bootstrap
+    constexpr size_t BootstrapPageSize = 50;
+    // messages returned by /message/search by default and at most
+    constexpr size_t SearchPageSize = 50;
+    constexpr size_t MaxSearchPageSize = 200;
+    // messages read per query while indexing messages missing from search index on start
+    constexpr size_t IndexCatchUpBatch = 10000;
+    constexpr size_t MaxUploadSize = 64 * 1024 * 1024;
+    // upload body is handed to file by pieces of this size
+    constexpr size_t UploadChunkSize = 64 * 1024;
+    // changes returned by one /sync request
+    constexpr size_t MaxSyncChanges = 500;
+
+    constexpr char JsonContentType[] = "application/json";
+    constexpr char AuthCookieAttrs[] = "path=/; SameSite=None; Secure";
+    // pre-encoded, logout cookies never change
+    constexpr char LogoutCookies[] = "userId=deleted; path=/; expires=Thu, 01 Jan 1970 00:00:00 GMT\nSet-Cookie:authToken=deleted; path=/; expires=Thu, 01 Jan 1970 00:00:00 GMT";
+
+    auto decodeJson(const std::string& s) {
+        TraceSpan span("json.decode");
+        return JsonDecoder().decode(s);
+    }
+
+    template<typename T>
+    std::string encodeJson(T&& node) {
+        TraceSpan span("json.encode");
+        return JsonEncoder().encode(std::forward<T>(node));
+    }
+
+    // exact path matches url without query, path ending with '*' matches any url starting with the rest
+    bool routeMatches(std::string_view path, std::string_view url) {
+        if (path.ends_with('*')) {
+            return url.starts_with(path.substr(0, path.size() - 1));
+        }
+        return url.substr(0, url.find('?')) == path;
+    }
+
+    // server may pass request to any registered wildcard matching it, e.g. "/message*" for "/message/search?...",
+    // so request is handled by the most specific route of the same method: exact path, else the longest prefix
+    size_t resolveRoute(size_t matched, std::string_view url) {
+        size_t res = matched;
+        size_t bestLength = 0;
+        bool bestExact = false;
+        for (size_t i = 0; i < Routes.size(); ++i) {
+            std::string_view path = Routes[i].path;
+            if ((Routes[i].method != Routes[matched].method) || !routeMatches(path, url)) {
+                continue;
+            }
+            bool exact = !path.ends_with('*');
+            if ((exact && !bestExact) || ((exact == bestExact) && (path.size() > bestLength))) {
+                res = i;
+                bestLength = path.size();
+                bestExact = exact;
+            }
+        }
+        return res;
+    }
+
+    const char* methodName(Method method) {
+        switch (method) {
+        case Method::GET: return "GET";
+        case Method::POST: return "POST";
+        case Method::DELETE: return "DELETE";
+        case Method::OPTIONS: return "OPTIONS";
+        default: return "OTHER";
+        }
+    }
+
+    // parses whole string as unsigned number, without allocations and exceptions
+    std::optional<size_t> parseId(std::string_view s) {
+        size_t res = 0;
+        auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), res);
+        if ((ec != std::errc()) || (ptr != s.data() + s.size()) || s.empty()) {
+            return std::nullopt;
+        }
+        return res;
+    }
+
+    // returns value of cookie 'name' from 'Cookie' header value ("a=1; b=2"), or empty view
+    std::string_view findCookie(std::string_view header, std::string_view name) {
+        while (!header.empty()) {
+            size_t end = header.find(';');
+            std::string_view pair = header.substr(0, end);
+            header = (end == std::string_view::npos) ? std::string_view() : header.substr(end + 1);
+            while (!pair.empty() && pair.front() == ' ') {
+                pair.remove_prefix(1);
+            }
+            if ((pair.size() > name.size()) && pair.starts_with(name) && (pair[name.size()] == '=')) {
+                return pair.substr(name.size() + 1);
+            }
+        }
+        return {};
+    }
+
+    // hashes of storage blobs linked from message text as /storage/<sha256>
+    std::vector<std::string> blobReferences(std::string_view text) {
+        constexpr std::string_view Prefix = "/storage/";
+        std::vector<std::string> res;
+        for (size_t pos = text.find(Prefix); pos != std::string_view::npos; pos = text.find(Prefix, pos + 1)) {
+            auto hash = text.substr(pos + Prefix.size(), 64);
+            if (BlobStore::isHash(hash) && (std::find(res.begin(), res.end(), hash) == res.end())) {
+                res.emplace_back(hash);
+            }
+        }
+        return res;
+    }
+
+}
+
+// authUserId is checked once by route wrapper, 0 if request is not authenticated
+#define NotAuthGuard size_t userId = authUserId; if (!userId) return response(request, 403);
+
+Api::Api(std::unique_ptr<db::MessengerDb> pdb, const std::filesystem::path& indexDir, const std::filesystem::path& storageDir, const std::filesystem::path& changeLogDir)
+    : db{std::move(pdb)}, searchIndex{indexDir}, blobStore{storageDir, [this](const auto& hashes) { return referencedBlobs(hashes); }}, changeLog{changeLogDir}
 {
     usernameByIdExtractor = [](const auto& user) {
         return std::make_pair(std::to_string(user.id), user.username);
@@ -21,27 +181,43 @@ Api::Api(std::unique_ptr<db::MessengerDb> pdb)
 
     onInit();
 
-    // test - TODO delete
-    HttpServer::get().registerRoute("/echo", Method::GET, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return echo(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/hello", Method::GET, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return hello(request, cbMsgFn); });
-    
-    HttpServer::get().registerRoute("/*", Method::OPTIONS, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return onOptions(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/user/find*", Method::GET, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return userFind(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/user/login", Method::POST, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return userRegisterOrLogin(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/user/logout", Method::POST, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return userLogout(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/contact", Method::POST, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return contactAdd(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/contact", Method::GET, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return contactsGetForId(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/contact", Method::DELETE, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return contactDelete(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/chat", Method::POST, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return chatAdd(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/chat", Method::GET, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return chatsGetForId(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/chat", Method::DELETE, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return chatDelete(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/message", Method::POST, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return txtMessageAdd(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/message*", Method::GET, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return txtMessagesGetForChatId(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/storage*", Method::GET, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return storageGet(request, cbMsgFn); });
-    HttpServer::get().registerRoute("/events", Method::GET, [this](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) { return eventsSubscribe(request, cbMsgFn); });
-}
-
-util::web::http::HttpResponse Api::onOptions(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+    for (size_t i = 0; i < Routes.size(); ++i) {
+        // two routes with the same path and method would silently shadow each other
+        for (size_t j = 0; j < i; ++j) {
+            if ((Routes[i].method == Routes[j].method) && (std::string_view(Routes[i].path) == Routes[j].path)) {
+                throw std::logic_error(std::format("route conflict: {} is registered twice", Routes[i].path));
+            }
+        }
+        routeLatencyMetrics.push_back(Metrics::get().histogram("messenger_http_request_duration_seconds", "Handler time of api routes", std::format("route=\"{}\",method=\"{}\"", Routes[i].path, methodName(Routes[i].method))));
+    }
+    for (size_t i = 0; i < Routes.size(); ++i) {
+        HttpServer::get().registerRoute(Routes[i].path, Routes[i].method, [this, i](const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn) {
+            size_t target = resolveRoute(i, request.url);
+            const Route& route = Routes[target];
+            TraceRequest trace(route.path);
+            RequestArena arena;
+            auto [auth, userId] = userIsAuthenticated(request);
+            size_t authUserId = auth ? userId : 0;
+            if (auto rejected = admit(request, route.cost, authUserId); rejected.has_value()) {
+                return std::move(rejected.value());
+            }
+            size_t start = tsMcs();
+            auto resp = (this->*route.handler)(request, cbMsgFn, authUserId);
+            size_t latency = tsMcs() - start;
+            admission.done(latency);
+            Metrics::get().observe(routeLatencyMetrics[target], latency);
+            return resp;
+            });
+    }
+    registerGauges();
+}
+
+Api::~Api() {
+    // clusterBus is destroyed before eventHub, whose dispatcher still reports users going offline while it stops
+    eventHub.setPresenceHandler(nullptr);
+}
+
+util::web::http::HttpResponse Api::onOptions(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t) {
     HttpHeaders headers;
     headers.add("Access-Control-Allow-Origin", request.headers.find("Origin"));
     headers.add("Access-Control-Allow-Headers", request.headers.find("Access-Control-Request-Headers"));
@@ -49,9 +225,9 @@ util::web::http::HttpResponse Api::onOptions(const util::web::http::HttpRequest&
     return response(request, 200, std::move(headers));
 }
 
-util::web::http::HttpResponse Api::userRegisterOrLogin(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::userRegisterOrLogin(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t) {
     try {
-        auto json = JsonDecoder().decode(request.body);
+        auto json = decodeJson(request.body);
         auto username = json.as<std::string>("username");
         auto pwdHash = json.as<std::string>("pwdHash");
         std::string authToken;
@@ -71,24 +247,24 @@ util::web::http::HttpResponse Api::userRegisterOrLogin(const util::web::http::Ht
             ;
         }
         HttpHeaders headers;
-        headers.add("Set-Cookie", std::format("userId={}; path=/; SameSite=None; Secure\nSet-Cookie:authToken={}; path=/; SameSite=None; Secure", userId, authToken));
+        addCookies(headers, { std::format("userId={}; {}", userId, AuthCookieAttrs), std::format("authToken={}; {}", authToken, AuthCookieAttrs) });
         return response(request, 200, std::move(headers));
     }
     catch (std::exception& ex) {
-        Log.info(ex.what());
+        alog::info("{}", ex.what());
         return response(request, 400);
     }
 }
 
-util::web::http::HttpResponse Api::userLogout(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::userLogout(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     //if (!isUserAuthenticated(request)) return notAuth(request);
     NotAuthGuard;
     HttpHeaders headers;
-    headers.add("Set-Cookie", std::format("userId=deleted; path=/; expires=Thu, 01 Jan 1970 00:00:00 GMT\nSet-Cookie:authToken=deleted; path=/; expires=Thu, 01 Jan 1970 00:00:00 GMT"));
+    headers.add("Set-Cookie", LogoutCookies);
     return response(request, 200, std::move(headers));
 }
 
-util::web::http::HttpResponse Api::userFind(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::userFind(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     try {
         NotAuthGuard;
         auto username = request.query.find("username");
@@ -99,20 +275,18 @@ util::web::http::HttpResponse Api::userFind(const util::web::http::HttpRequest&
         if (!id.has_value()) {
             return response(request, 404);
         }
-        HttpHeaders headers;
-        headers.add("Content-Type", "application/json");
-        return response(request, 200, std::move(headers), JsonEncoder().encode(Node(ValNode((int64_t)id.value()))));
+        return jsonResponse(request, 200, encodeJson(Node(ValNode((int64_t)id.value()))));
     }
     catch (std::exception& ex) {
-        Log.info(ex.what());
+        alog::info("{}", ex.what());
         return response(request, 400);
     }
 }
 
-util::web::http::HttpResponse Api::contactAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::contactAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     try {
         NotAuthGuard;
-        auto json = JsonDecoder().decode(request.body);
+        auto json = decodeJson(request.body);
         auto withId = json.as<size_t>("withId");
         auto [err, optAddrBookEntryId] = db->addContactToAddressBook(userId, withId);
         if (err != db::MessengerDb::Error::Ok) {
@@ -125,36 +299,28 @@ util::web::http::HttpResponse Api::contactAdd(const util::web::http::HttpRequest
         }
         sharedCache.contactAdd({ optAddrBookEntryId.value(), userId, withId });
         sharedCache.contactAdd({ optAddrBookEntryId2.value(), withId, userId });
-        HttpHeaders headers;
-        headers.add("Content-Type", "application/json");
         db::AddressBook addrBook(optAddrBookEntryId.value(), userId, withId);
-        return response(request, 200, std::move(headers), JsonEncoder().encode(Node(addrBook.toObjNode())));
+        db::AddressBook addrBook2(optAddrBookEntryId2.value(), withId, userId);
+        auto body = encodeJson(Node(addrBook.toObjNode()));
+        changeLog.add(userId, ChangeLog::Kind::ContactAdd, addrBook.id, std::make_shared<const std::string>(body));
+        changeLog.add(withId, ChangeLog::Kind::ContactAdd, addrBook2.id, std::make_shared<const std::string>(encodeJson(Node(addrBook2.toObjNode()))));
+        return jsonResponse(request, 200, std::move(body));
     }
     catch (std::exception& ex) {
-        Log.info(ex.what());
+        alog::info("{}", ex.what());
         return response(request, 400);
     }
 }
 
-util::web::http::HttpResponse Api::contactsGetForId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::contactsGetForId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     NotAuthGuard;
-    auto contacts = sharedCache.contactGetForId(userId);
-    ObjNode resContacts = ObjNode::makeFrom(contacts, [](const auto& contact) { return std::make_pair(std::to_string(contact.id), contact.toObjNode()); });
-    auto users = sharedCache.usersFindById(contacts, [](const SharedCache::AddressBookT& contact) { return std::vector<size_t>{contact.withId, contact.whoId}; });
-    ObjNode resUsers = ObjNode::makeFrom(users, usernameByIdExtractor);
-    ObjNode res({
-        {"contacts", std::move(resContacts)},
-        {"users", std::move(resUsers)}
-        });
-    HttpHeaders headers;
-    headers.add("Content-Type", "application/json");
-    return response(request, 200, std::move(headers), JsonEncoder().encode(Node(res)));
+    return jsonResponse(request, 200, encodeJson(Node(contactsView(userId))));
 }
 
-util::web::http::HttpResponse Api::contactDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::contactDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     try {
         NotAuthGuard;
-        auto json = JsonDecoder().decode(request.body);
+        auto json = decodeJson(request.body);
         auto contactId = json.as<size_t>("id");
         if (!sharedCache.contactDelete(contactId, userId)) {
             return response(request, 400);
@@ -163,55 +329,53 @@ util::web::http::HttpResponse Api::contactDelete(const util::web::http::HttpRequ
         if (err != db::MessengerDb::Error::Ok || !ok) {
             return response(request, 400);
         }
+        changeLog.add(userId, ChangeLog::Kind::ContactDelete, contactId);
         return response(request, 200);
     }
     catch (std::exception& ex) {
-        Log.info(ex.what());
+        alog::info("{}", ex.what());
         return response(request, 400);
     }
 }
 
-util::web::http::HttpResponse Api::chatAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::chatAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     try {
         NotAuthGuard;
-        auto json = JsonDecoder().decode(request.body);
+        auto json = decodeJson(request.body);
         auto withId = json.as<size_t>("withId");
         auto [err, optChatEntryId] = db->addChat(userId, withId);
         if (err != db::MessengerDb::Error::Ok) {
             throw std::invalid_argument(std::format("can't add chat for id {}: err = {}", userId, (int)err));
         }
         sharedCache.chatAdd({ optChatEntryId.value(), userId, withId });
-        HttpHeaders headers;
-        headers.add("Content-Type", "application/json");
         db::Chat chat(optChatEntryId.value(), userId, withId);
-        return response(request, 200, std::move(headers), JsonEncoder().encode(Node(chat.toObjNode())));
+        auto body = encodeJson(Node(chat.toObjNode()));
+        changeLog.add(chatParticipants(chat), ChangeLog::Kind::ChatAdd, chat.id, std::make_shared<const std::string>(body));
+        return jsonResponse(request, 200, std::move(body));
     }
     catch (std::exception& ex) {
-        Log.info(ex.what());
+        alog::info("{}", ex.what());
         return response(request, 400);
     }
 }
 
-util::web::http::HttpResponse Api::chatsGetForId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::chatsGetForId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     NotAuthGuard;
-    auto chats = sharedCache.chatsGetForId(userId);
-    ObjNode resChats = ObjNode::makeFrom(chats, [](const auto& chat) { return std::make_pair(std::to_string(chat.id), chat.toObjNode()); });
-    auto users = sharedCache.usersFindById(chats, [](const SharedCache::ChatT& chat) { return std::vector<size_t>{chat.withId, chat.whoId}; });
-    ObjNode resUsers = ObjNode::makeFrom(users, usernameByIdExtractor);
-    ObjNode res({
-        {"chats", std::move(resChats)},
-        {"users", std::move(resUsers)}
-        });
-    HttpHeaders headers;
-    headers.add("Content-Type", "application/json");
-    return response(request, 200, std::move(headers), JsonEncoder().encode(Node(res)));
+    return jsonResponse(request, 200, encodeJson(Node(chatsView(userId))));
 }
 
-util::web::http::HttpResponse Api::chatDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::chatDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     try {
         NotAuthGuard;
-        auto json = JsonDecoder().decode(request.body);
+        auto json = decodeJson(request.body);
         auto chatId = json.as<size_t>("id");
+        auto chats = sharedCache.chatsGetForId(userId);
+        auto iter = chats.find(db::Chat(chatId));
+        if (iter == chats.end()) {
+            return response(request, 400);
+        }
+        // members are gone from cache after delete
+        auto participants = chatParticipants(*iter);
         if (!sharedCache.chatDelete(chatId, userId)) {
             return response(request, 400);
         }
@@ -219,18 +383,121 @@ util::web::http::HttpResponse Api::chatDelete(const util::web::http::HttpRequest
         if (err != db::MessengerDb::Error::Ok || !ok) {
             return response(request, 400);
         }
+        changeLog.add(participants, ChangeLog::Kind::ChatDelete, chatId);
         return response(request, 200);
     }
     catch (std::exception& ex) {
-        Log.info(ex.what());
+        alog::info("{}", ex.what());
         return response(request, 400);
     }
 }
 
-util::web::http::HttpResponse Api::txtMessageAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::chatGroupAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     try {
         NotAuthGuard;
-        auto json = JsonDecoder().decode(request.body);
+        auto [err, optChatId] = db->addGroupChat(userId);
+        if (err != db::MessengerDb::Error::Ok) {
+            throw std::invalid_argument(std::format("can't add group chat for id {}: err = {}", userId, (int)err));
+        }
+        db::Chat chat(optChatId.value(), userId, 0);
+        sharedCache.chatAdd(chat);
+        auto body = encodeJson(Node(chat.toObjNode()));
+        changeLog.add(userId, ChangeLog::Kind::ChatAdd, chat.id, std::make_shared<const std::string>(body));
+        return jsonResponse(request, 200, std::move(body));
+    }
+    catch (std::exception& ex) {
+        alog::info("{}", ex.what());
+        return response(request, 400);
+    }
+}
+
+util::web::http::HttpResponse Api::chatMemberAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
+    try {
+        NotAuthGuard;
+        auto json = decodeJson(request.body);
+        auto chatId = json.as<size_t>("chatId");
+        auto memberId = json.as<size_t>("userId");
+        auto chats = sharedCache.chatsGetForId(userId);
+        // only creator manages members
+        auto iter = chats.find(db::Chat(chatId));
+        if ((iter == chats.end()) || !iter->isGroup() || (iter->whoId != userId)) {
+            return response(request, 403);
+        }
+        if (!sharedCache.userExists(memberId)) {
+            return response(request, 400);
+        }
+        auto [err, ok] = db->addChatMember(chatId, memberId);
+        if ((err != db::MessengerDb::Error::Ok) || !ok) {
+            return response(request, 400);
+        }
+        sharedCache.chatMemberAdd(chatId, memberId);
+        changeLog.add(memberId, ChangeLog::Kind::ChatAdd, chatId, std::make_shared<const std::string>(encodeJson(Node(iter->toObjNode()))));
+        return response(request, 200);
+    }
+    catch (std::exception& ex) {
+        alog::info("{}", ex.what());
+        return response(request, 400);
+    }
+}
+
+util::web::http::HttpResponse Api::chatMembersGet(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
+    try {
+        NotAuthGuard;
+        auto optChatId = parseId(request.query.find("chatId"));
+        if (!optChatId.has_value()) {
+            return response(request, 400);
+        }
+        if (!sharedCache.chatsGetForId(userId).contains(db::Chat(optChatId.value()))) {
+            return response(request, 403);
+        }
+        auto members = sharedCache.chatMembers(optChatId.value());
+        if (!members) {
+            return response(request, 400);
+        }
+        auto users = sharedCache.usersFindById(*members, [](size_t id) { return std::array<size_t, 1>{ id }; });
+        return jsonResponse(request, 200, encodeJson(Node(ObjNode({
+            {"users", ObjNode::makeFrom(users, usernameByIdExtractor)}
+            }))));
+    }
+    catch (std::exception& ex) {
+        alog::info("{}", ex.what());
+        return response(request, 400);
+    }
+}
+
+util::web::http::HttpResponse Api::chatMemberDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
+    try {
+        NotAuthGuard;
+        auto json = decodeJson(request.body);
+        auto chatId = json.as<size_t>("chatId");
+        auto memberId = json.as<size_t>("userId");
+        auto chats = sharedCache.chatsGetForId(userId);
+        auto iter = chats.find(db::Chat(chatId));
+        if ((iter == chats.end()) || !iter->isGroup()) {
+            return response(request, 403);
+        }
+        // creator removes anybody, member only leaves; creator deletes chat instead of leaving
+        if ((memberId == iter->whoId) || ((userId != iter->whoId) && (userId != memberId))) {
+            return response(request, 403);
+        }
+        auto [err, ok] = db->deleteChatMember(chatId, memberId);
+        if ((err != db::MessengerDb::Error::Ok) || !ok) {
+            return response(request, 400);
+        }
+        sharedCache.chatMemberDelete(chatId, memberId);
+        changeLog.add(memberId, ChangeLog::Kind::ChatDelete, chatId);
+        return response(request, 200);
+    }
+    catch (std::exception& ex) {
+        alog::info("{}", ex.what());
+        return response(request, 400);
+    }
+}
+
+util::web::http::HttpResponse Api::txtMessageAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
+    try {
+        NotAuthGuard;
+        auto json = decodeJson(request.body);
         auto chatId = json.as<size_t>("chatId");
         std::string message = json.as<std::string>("message");
         auto chats = sharedCache.chatsGetForId(userId);
@@ -246,60 +513,295 @@ util::web::http::HttpResponse Api::txtMessageAdd(const util::web::http::HttpRequ
         if (err != db::MessengerDb::Error::Ok) {
             return response(request, 400);
         }
-        HttpHeaders headers;
-        headers.add("Content-Type", "application/json");
         db::TxtMessage msg(optId.value(), chatId, userId, message, ts);
-        auto body = JsonEncoder().encode(Node(msg.toObjNode()));
-        EventBroker::get().emitEvent(userId == curChat.whoId ? curChat.withId : curChat.whoId, "data: " + body + "\r\n\r\n");
-        auto resp = response(request, 200, std::move(headers), std::move(body));
-        return resp;
+        auto body = encodeJson(Node(msg.toObjNode()));
+        // encoded once, events and change logs of all members share the buffer
+        auto shared = std::make_shared<const std::string>(body);
+        if (curChat.isGroup()) {
+            if (auto members = sharedCache.chatMembers(chatId); members) {
+                publish(*members, shared, userId);
+            }
+        }
+        else {
+            publish({ userId == curChat.whoId ? curChat.withId : curChat.whoId }, shared);
+        }
+        searchIndex.add(chatId, msg.id, message);
+        // sender too, for its other devices
+        changeLog.add(chatParticipants(curChat), ChangeLog::Kind::MessageAdd, msg.id, std::move(shared));
+        // touching protects blob from collection until reference is in db
+        // only blobs sender has uploaded, links to foreign blobs stay plain links
+        auto [ownedErr, hashes] = db->getOwnedBlobs(userId, blobReferences(message));
+        if (ownedErr != db::MessengerDb::Error::Ok) {
+            alog::error("can't check attachments of message {}: err = {}", msg.id, (int)ownedErr);
+        }
+        std::erase_if(hashes, [this](const auto& hash) { return !blobStore.touch(hash); });
+        if (auto [attachErr, _] = db->addAttachments(msg.id, hashes); attachErr != db::MessengerDb::Error::Ok) {
+            alog::error("can't add attachments of message {}: err = {}", msg.id, (int)attachErr);
+        }
+        return jsonResponse(request, 200, std::move(body));
     }
     catch (std::exception& ex) {
-        Log.info(ex.what());
+        alog::info("{}", ex.what());
         return response(request, 400);
     }
 }
 
-util::web::http::HttpResponse Api::txtMessagesGetForChatId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::txtMessagesGetForChatId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     try {
         NotAuthGuard;
-        auto sChatId = request.query.find("chatId");
-        if (sChatId.empty()) {
+        auto optChatId = parseId(request.query.find("chatId"));
+        if (!optChatId.has_value()) {
             return response(request, 400);
         }
-        size_t chatId = std::stoull(sChatId);
-        if (!sharedCache.chatsGetForId(userId).contains(db::Chat(chatId))) {
+        auto optView = messagesView(userId, optChatId.value());
+        if (!optView.has_value()) {
             return response(request, 403);
         }
-        auto [err, messages] = db->getTxtMessagesForChat(chatId);
+        return jsonResponse(request, 200, encodeJson(Node(std::move(optView.value()))));
+    }
+    catch (std::exception& ex) {
+        alog::info("{}", ex.what());
+        return response(request, 400);
+    }
+}
+
+util::web::http::HttpResponse Api::messageSearch(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
+    try {
+        NotAuthGuard;
+        const auto& query = request.query.find("q");
+        if (query.empty()) {
+            return response(request, 400);
+        }
+        size_t limit = SearchPageSize;
+        if (const auto& sLimit = request.query.find("limit"); !sLimit.empty()) {
+            auto optLimit = parseId(sLimit);
+            if (!optLimit.has_value() || (optLimit.value() == 0)) {
+                return response(request, 400);
+            }
+            limit = std::min(optLimit.value(), MaxSearchPageSize);
+        }
+        // searching only in chats of user, so index never leaks messages of other chats
+        std::pmr::vector<size_t> chatIds{ RequestArena::current() };
+        auto chats = sharedCache.chatsGetForId(userId);
+        if (const auto& sChatId = request.query.find("chatId"); !sChatId.empty()) {
+            auto optChatId = parseId(sChatId);
+            if (!optChatId.has_value()) {
+                return response(request, 400);
+            }
+            if (!chats.contains(db::Chat(optChatId.value()))) {
+                return response(request, 403);
+            }
+            chatIds.push_back(optChatId.value());
+        }
+        else {
+            for (const auto& chat : chats) {
+                chatIds.push_back(chat.id);
+            }
+        }
+        std::pmr::vector<size_t> ids{ RequestArena::current() };
+        {
+            TraceSpan span("search.index");
+            ids = searchIndex.search(chatIds, query, limit, RequestArena::current());
+        }
+        // messages of deleted chats are still in index, but not in db
+        auto [err, messages] = db->getTxtMessagesByIds(ids);
         if (err != db::MessengerDb::Error::Ok) {
             return response(request, 400);
         }
         ObjNode resMessages = ObjNode::makeFrom(messages, [](const auto& message) { return std::make_pair(std::to_string(message.id), message.toObjNode()); });
         auto users = sharedCache.usersFindById(messages, [](const db::TxtMessage& message) { return std::vector<size_t>{message.whoId}; });
         ObjNode resUsers = ObjNode::makeFrom(users, usernameByIdExtractor);
-        ObjNode res({
+        return jsonResponse(request, 200, encodeJson(Node(ObjNode({
             {"messages", std::move(resMessages)},
             {"users", std::move(resUsers)}
+            }))));
+    }
+    catch (std::exception& ex) {
+        alog::info("{}", ex.what());
+        return response(request, 400);
+    }
+}
+
+util::web::http::HttpResponse Api::batch(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
+    try {
+        NotAuthGuard;
+        auto json = decodeJson(request.body);
+        auto ops = json.as<std::vector<std::string>>("ops");
+        if (ops.size() > MaxBatchOps) {
+            return response(request, 400);
+        }
+        std::pmr::vector<std::pair<std::string, ObjNode>> results{ RequestArena::current() };
+        for (const auto& op : ops) {
+            auto [code, optBody] = batchOp(userId, op);
+            if (optBody.has_value()) {
+                results.emplace_back(std::string(op), ObjNode({ {"status", (int64_t)code}, {"body", std::move(optBody.value())} }));
+            }
+            else {
+                results.emplace_back(std::string(op), ObjNode({ {"status", (int64_t)code} }));
+            }
+        }
+        ObjNode res = ObjNode::makeFrom(results, [](const auto& result) { return result; });
+        return jsonResponse(request, 200, encodeJson(Node(res)));
+    }
+    catch (std::exception& ex) {
+        alog::info("{}", ex.what());
+        return response(request, 400);
+    }
+}
+
+util::web::http::HttpResponse Api::bootstrap(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
+    try {
+        NotAuthGuard;
+        auto contacts = sharedCache.contactGetForId(userId);
+        auto chats = sharedCache.chatsGetForId(userId);
+        std::pmr::vector<size_t> chatIds{ RequestArena::current() };
+        chatIds.reserve(chats.size());
+        std::pmr::unordered_set<size_t> userIds{ RequestArena::current() };
+        for (const auto& contact : contacts) {
+            userIds.insert(contact.whoId);
+            userIds.insert(contact.withId);
+        }
+        for (const auto& chat : chats) {
+            chatIds.push_back(chat.id);
+            userIds.insert(chat.whoId);
+            userIds.insert(chat.withId);
+        }
+        // latest page of every chat in one query
+        auto [err, messages] = db->getLastTxtMessagesForChats(chatIds, BootstrapPageSize);
+        if (err != db::MessengerDb::Error::Ok) {
+            return response(request, 500);
+        }
+        std::pmr::unordered_map<size_t, std::pmr::vector<const db::TxtMessage*>> messagesByChat{ RequestArena::current() };
+        for (const auto& message : messages) {
+            messagesByChat[message.chatId].push_back(&message);
+            userIds.insert(message.whoId);
+        }
+        ObjNode resMessages = ObjNode::makeFrom(messagesByChat, [](const auto& chatMessages) {
+            return std::make_pair(std::to_string(chatMessages.first), ObjNode::makeFrom(chatMessages.second, [](const auto* message) { return std::make_pair(std::to_string(message->id), message->toObjNode()); }));
             });
-        HttpHeaders headers;
-        headers.add("Content-Type", "application/json");
-        return response(request, 200, std::move(headers), JsonEncoder().encode(Node(res)));
+        ObjNode res({
+            {"contacts", ObjNode::makeFrom(contacts, [](const auto& contact) { return std::make_pair(std::to_string(contact.id), contact.toObjNode()); })},
+            {"chats", ObjNode::makeFrom(chats, [](const auto& chat) { return std::make_pair(std::to_string(chat.id), chat.toObjNode()); })},
+            {"messages", std::move(resMessages)},
+            {"users", ObjNode::makeFrom(sharedCache.usersFindById(userIds, [](size_t id) { return std::array<size_t, 1>{ id }; }), usernameByIdExtractor)}
+            });
+        return jsonResponse(request, 200, encodeJson(Node(res)));
+    }
+    catch (std::exception& ex) {
+        alog::info("{}", ex.what());
+        return response(request, 400);
+    }
+}
+
+util::web::http::HttpResponse Api::sync(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
+    try {
+        NotAuthGuard;
+        // cursor is taken before client reloads its state, so nothing is missed in between
+        auto cursor = changeLog.cursor(userId);
+        auto optDelta = changeLog.since(userId, request.query.find("since"), MaxSyncChanges);
+        if (!optDelta.has_value()) {
+            return jsonResponse(request, 410, encodeJson(Node(ObjNode({ {"cursor", ValNode(cursor)} }))));
+        }
+        const auto& delta = optDelta.value();
+        // data of changes is already encoded json, so response is assembled without decoding it again
+        std::string body = std::format("{{\"cursor\":\"{}\",\"more\":{},\"changes\":[", delta.cursor, delta.more);
+        for (size_t i = 0; i < delta.changes.size(); ++i) {
+            const auto& change = delta.changes[i];
+            body += std::format("{}{{\"seq\":{},\"type\":\"{}\",\"id\":{}", (i ? "," : ""), change.seq, ChangeLog::kindName(change.kind), change.id);
+            if (change.data) {
+                body += ",\"data\":";
+                body += *change.data;
+            }
+            body += '}';
+        }
+        body += "]}";
+        return jsonResponse(request, 200, std::move(body));
     }
     catch (std::exception& ex) {
-        Log.info(ex.what());
+        alog::info("{}", ex.what());
         return response(request, 400);
     }
 }
 
-util::web::http::HttpResponse Api::storageGet(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::storageGet(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
     NotAuthGuard;
-    auto resp = HttpServer::get().getEntireFile(request.url, request);
+    constexpr std::string_view Prefix = "/storage/";
+    std::string_view hash = std::string_view(request.url).substr(std::min(request.url.size(), Prefix.size()));
+    if (!BlobStore::isHash(hash)) {
+        // file uploaded before blobs, served as before; partial uploads in storage/tmp are never served
+        if (!BlobStore::isLegacyPath(hash)) {
+            return response(request, 404);
+        }
+        auto resp = HttpServer::get().getEntireFile(request.url, request);
+        return response(request, resp.status, std::move(resp.headers), std::move(resp.body));
+    }
+    // blob never changes, so its hash is a strong etag and it may be cached forever
+    std::string etag = std::format("\"{}\"", hash);
+    HttpHeaders headers;
+    headers.add("ETag", etag);
+    headers.add("Cache-Control", "private, max-age=31536000, immutable");
+    if (request.headers.find("If-None-Match") == etag) {
+        return response(request, 304, std::move(headers));
+    }
+    auto resp = HttpServer::get().getEntireFile(std::format("{}{}", Prefix, BlobStore::relativePath(hash)), request);
+    if (resp.status == 200) {
+        resp.headers.add("ETag", etag);
+        resp.headers.add("Cache-Control", "private, max-age=31536000, immutable");
+    }
     return response(request, resp.status, std::move(resp.headers), std::move(resp.body));
     //return response(request, 200, {}, "<html><body><h1>Hi, storage!</h1></body></html>");
 }
 
-util::web::http::HttpResponse Api::eventsSubscribe(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cb) {
+util::web::http::HttpResponse Api::storageUpload(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t authUserId) {
+    try {
+        NotAuthGuard;
+        // rejecting before anything is written, if client announced size
+        if (const auto& contentLength = request.headers.find("Content-Length"); !contentLength.empty()) {
+            auto optSize = parseId(contentLength);
+            if (optSize.has_value() && (optSize.value() > MaxUploadSize)) {
+                return response(request, 413);
+            }
+        }
+        // client sending hash of file it has uploaded before skips the upload, if blob is still stored.
+        // Hash alone proves nothing, so it doesn't give access to blob uploaded by someone else
+        if (const auto& hash = request.headers.find("X-Content-Sha256"); BlobStore::isHash(hash) && ownsBlob(userId, hash) && blobStore.touch(hash)) {
+            return jsonResponse(request, 200, encodeJson(Node(ObjNode({
+                {"url", ValNode(std::format("/storage/{}", hash))},
+                {"sha256", ValNode(hash)},
+                {"size", ValNode((int64_t)std::filesystem::file_size(blobStore.path(hash)))}
+                }))));
+        }
+        // body is already buffered by HttpServer, it is written in chunks only to hash and store it in one pass
+        auto sink = blobStore.sink(MaxUploadSize);
+        std::string_view body = request.body;
+        for (size_t pos = 0; pos < body.size(); pos += UploadChunkSize) {
+            switch (sink.write(body.substr(pos, UploadChunkSize))) {
+            case UploadSink::Status::Ok: break;
+            case UploadSink::Status::TooLarge: return response(request, 413);
+            case UploadSink::Status::IoError: return response(request, 500);
+            }
+        }
+        auto optHash = blobStore.put(sink);
+        if (!optHash.has_value()) {
+            return response(request, 500);
+        }
+        if (auto [ownerErr, _] = db->addBlobOwner(userId, optHash.value()); ownerErr != db::MessengerDb::Error::Ok) {
+            return response(request, 500);
+        }
+        alog::debug("User {} uploaded {} bytes as {}", userId, sink.size(), optHash.value());
+        return jsonResponse(request, 200, encodeJson(Node(ObjNode({
+            {"url", ValNode(std::format("/storage/{}", optHash.value()))},
+            {"sha256", ValNode(optHash.value())},
+            {"size", ValNode((int64_t)sink.size())}
+            }))));
+    }
+    catch (std::exception& ex) {
+        alog::info("{}", ex.what());
+        return response(request, 400);
+    }
+}
+
+util::web::http::HttpResponse Api::eventsSubscribe(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cb, size_t authUserId) {
     NotAuthGuard;
     HttpHeaders headers;
     headers.add("Content-Type", "text/event-stream");
@@ -307,11 +809,13 @@ util::web::http::HttpResponse Api::eventsSubscribe(const util::web::http::HttpRe
     headers.add("Cache-Control", "no-store");
     headers.add("Access-Control-Allow-Credentials", "true");
     headers.borrow(request.headers, "Origin", "", "Access-Control-Allow-Origin");
-    EventBroker::get().registerProducerAndHandler(userId, cb);
+    // browser sends Last-Event-ID when EventSource reconnects
+    const auto& lastEventId = request.headers.find("Last-Event-ID");
+    eventHub.subscribe(userId, cb, lastEventId);
     /*std::thread([this, userId, request, headers]() {
         for(size_t i = 0; i < 10; ++i) {
             std::this_thread::sleep_for(std::chrono::seconds(10));
-            EventBroker::get().emitEvent(userId, std::string("data: Hello EventSource\r\n\r\n"));
+            eventHub.emit(userId, std::string("Hello EventSource"));
         }
         }).detach();*/
     return HttpResponse(200, std::move(headers), "HTTP/1.1 200\r\n", request.headers);
@@ -319,7 +823,7 @@ util::web::http::HttpResponse Api::eventsSubscribe(const util::web::http::HttpRe
 }
 
 util::web::http::HttpResponse Api::response(const util::web::http::HttpRequest& request, size_t code, util::web::http::HttpHeaders&& headers, std::string&& body) {
-    Log.info(std::format("Sending response {}", code));
+    alog::debug("Sending response {}", code);
     headers.add("Content-Length", body.size());
     headers.borrow(request.headers, "Connection");
     headers.borrow(request.headers, "Origin", "", "Access-Control-Allow-Origin");
@@ -332,7 +836,31 @@ util::web::http::HttpResponse Api::response(const util::web::http::HttpRequest&
     );
 }
 
-util::web::http::HttpResponse Api::echo(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::jsonResponse(const util::web::http::HttpRequest& request, size_t code, std::string&& body) {
+    HttpHeaders headers;
+    headers.add("Content-Type", JsonContentType);
+    return response(request, code, std::move(headers), std::move(body));
+}
+
+void Api::addCookies(util::web::http::HttpHeaders& headers, std::initializer_list<std::string> cookies) {
+    // HttpHeaders keeps one value per name, so several Set-Cookie lines are folded into one value
+    static constexpr std::string_view Separator = "\nSet-Cookie:";
+    size_t size = 0;
+    for (const auto& cookie : cookies) {
+        size += cookie.size() + Separator.size();
+    }
+    std::string value;
+    value.reserve(size);
+    for (const auto& cookie : cookies) {
+        if (!value.empty()) {
+            value += Separator;
+        }
+        value += cookie;
+    }
+    headers.add("Set-Cookie", value);
+}
+
+util::web::http::HttpResponse Api::echo(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t) {
     std::string srequest = request.encode();
     //std::osyncstream(std::cout) << srequest << std::endl;
     auto headers = request.headers;
@@ -347,35 +875,185 @@ util::web::http::HttpResponse Api::echo(const util::web::http::HttpRequest& requ
     return response;
 }
 
-util::web::http::HttpResponse Api::hello(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn) {
+util::web::http::HttpResponse Api::hello(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn, size_t) {
     std::string srequest = request.encode();
     //std::osyncstream(std::cout) << srequest << std::endl;
     return response(request, 200, HttpHeaders(), "<html><body><h1>Hello</h1></body></html>");
 }
 
+std::optional<util::web::http::HttpResponse> Api::admit(const util::web::http::HttpRequest& request, size_t cost, size_t authUserId) {
+    if (cost == 0) {
+        return std::nullopt;
+    }
+    // cookies were checked, not just present, so client can't get a fresh bucket by changing them
+    auto decision = admission.admit(authUserId ? authUserId : AdmissionControl::AnonymousKey, cost, tsMs());
+    if (decision.verdict == AdmissionControl::Verdict::Admit) {
+        return std::nullopt;
+    }
+    HttpHeaders headers;
+    headers.add("Retry-After", decision.retryAfterSec);
+    return response(request, decision.verdict == AdmissionControl::Verdict::RateLimited ? 429 : 503, std::move(headers));
+}
+
+util::web::json::ObjNode Api::contactsView(size_t userId) {
+    auto contacts = sharedCache.contactGetForId(userId);
+    ObjNode resContacts = ObjNode::makeFrom(contacts, [](const auto& contact) { return std::make_pair(std::to_string(contact.id), contact.toObjNode()); });
+    auto users = sharedCache.usersFindById(contacts, [](const SharedCache::AddressBookT& contact) { return std::vector<size_t>{contact.withId, contact.whoId}; });
+    ObjNode resUsers = ObjNode::makeFrom(users, usernameByIdExtractor);
+    return ObjNode({
+        {"contacts", std::move(resContacts)},
+        {"users", std::move(resUsers)}
+        });
+}
+
+util::web::json::ObjNode Api::chatsView(size_t userId) {
+    auto chats = sharedCache.chatsGetForId(userId);
+    ObjNode resChats = ObjNode::makeFrom(chats, [](const auto& chat) { return std::make_pair(std::to_string(chat.id), chat.toObjNode()); });
+    auto users = sharedCache.usersFindById(chats, [](const SharedCache::ChatT& chat) { return std::vector<size_t>{chat.withId, chat.whoId}; });
+    ObjNode resUsers = ObjNode::makeFrom(users, usernameByIdExtractor);
+    return ObjNode({
+        {"chats", std::move(resChats)},
+        {"users", std::move(resUsers)}
+        });
+}
+
+std::optional<util::web::json::ObjNode> Api::messagesView(size_t userId, size_t chatId) {
+    if (!sharedCache.chatsGetForId(userId).contains(db::Chat(chatId))) {
+        return std::nullopt;
+    }
+    auto [err, messages] = db->getTxtMessagesForChat(chatId);
+    if (err != db::MessengerDb::Error::Ok) {
+        throw std::runtime_error(std::format("can't get messages for chat {}: err = {}", chatId, (int)err));
+    }
+    ObjNode resMessages = ObjNode::makeFrom(messages, [](const auto& message) { return std::make_pair(std::to_string(message.id), message.toObjNode()); });
+    auto users = sharedCache.usersFindById(messages, [](const db::TxtMessage& message) { return std::vector<size_t>{message.whoId}; });
+    ObjNode resUsers = ObjNode::makeFrom(users, usernameByIdExtractor);
+    return ObjNode({
+        {"messages", std::move(resMessages)},
+        {"users", std::move(resUsers)}
+        });
+}
+
+std::pair<size_t, std::optional<util::web::json::ObjNode>> Api::batchOp(size_t userId, std::string_view op) {
+    try {
+        if (op == "contacts") {
+            return { 200, contactsView(userId) };
+        }
+        if (op == "chats") {
+            return { 200, chatsView(userId) };
+        }
+        if (op.starts_with("messages:")) {
+            auto optChatId = parseId(op.substr(std::string_view("messages:").size()));
+            if (!optChatId.has_value()) {
+                return { 400, std::nullopt };
+            }
+            auto optView = messagesView(userId, optChatId.value());
+            if (!optView.has_value()) {
+                return { 403, std::nullopt };
+            }
+            return { 200, std::move(optView) };
+        }
+        return { 404, std::nullopt };
+    }
+    catch (std::exception& ex) {
+        // op names are checked above, so only server side failures get here
+        alog::error("{}", ex.what());
+        return { 500, std::nullopt };
+    }
+}
+
+void Api::startCluster(size_t nodeId, std::vector<std::string> nodes) {
+    clusterBus = std::make_unique<ClusterBus>(nodeId, std::move(nodes), [this](const std::vector<size_t>& userIds, ClusterBus::EventPtr data) {
+        // local streams only, event came from node that has already forwarded it
+        eventHub.emit(userIds, std::move(data));
+        });
+    eventHub.setPresenceHandler([this](size_t userId, bool online) {
+        if (online) {
+            clusterBus->userOnline(userId);
+        }
+        else {
+            clusterBus->userOffline(userId);
+        }
+        });
+    Metrics::get().gauge("messenger_cluster_connected_peers", "Cluster nodes this node is connected to", [this]() { return (double)clusterBus->stats().connectedPeers; });
+    Metrics::get().counter("messenger_cluster_forwarded_events_total", "Events forwarded to other cluster nodes", [this]() { return (double)clusterBus->stats().forwardedEvents; });
+    Metrics::get().counter("messenger_cluster_dropped_events_total", "Events not forwarded because node was disconnected or its outbox was full", [this]() { return (double)clusterBus->stats().droppedEvents; });
+}
+
+void Api::publish(const std::vector<size_t>& userIds, EventHub::EventPtr data, size_t exceptUserId) {
+    eventHub.emit(userIds, data, exceptUserId);
+    if (clusterBus) {
+        clusterBus->forward(userIds, std::move(data), exceptUserId);
+    }
+}
+
+void Api::registerGauges() {
+    Metrics::get().gauge("messenger_sse_subscriptions", "Active /events subscriptions", [this]() { return (double)eventHub.stats().subscriptions; });
+    Metrics::get().gauge("messenger_sse_queued_events", "Events waiting in subscription queues", [this]() { return (double)eventHub.stats().queuedEvents; });
+    Metrics::get().counter("messenger_sse_dropped_events_total", "Events dropped on subscription queue overflow", [this]() { return (double)eventHub.stats().droppedEvents; });
+    Metrics::get().counter("messenger_admission_requests_total", "Requests by admission decision", [this]() { return (double)admission.stats().admitted; }, "decision=\"admitted\"");
+    Metrics::get().counter("messenger_admission_requests_total", "Requests by admission decision", [this]() { return (double)admission.stats().rateLimited; }, "decision=\"rate_limited\"");
+    Metrics::get().counter("messenger_admission_requests_total", "Requests by admission decision", [this]() { return (double)admission.stats().overloaded; }, "decision=\"overloaded\"");
+    Metrics::get().counter("messenger_request_arena_spills_total", "Requests that needed more memory than initial arena block", []() { return (double)RequestArena::spills(); });
+    Metrics::get().counter("messenger_log_dropped_records_total", "Log records dropped on ring overflow", []() { return (double)AsyncLog::get().dropped(); });
+}
+
 void Api::onInit() {
     // populating cache
     auto [err1, vusers] = db->getUsers();
     auto [err2, vaddrBooks] = db->getAddressBooks();
     auto [err3, vchats] = db->getChats();
+    auto [err4, vmembers] = db->getChatMembers();
     SharedCache::UsersV susers(vusers.begin(), vusers.end());
     SharedCache::AddressBooksV saddrBooks(vaddrBooks.begin(), vaddrBooks.end());
     SharedCache::ChatsV schats(vchats.begin(), vchats.end());
-    sharedCache.init(std::move(susers), std::move(saddrBooks), std::move(schats));
+    sharedCache.init(std::move(susers), std::move(saddrBooks), std::move(schats), std::move(vmembers));
+    // indexing messages that were not persisted in search index before last stop
+    size_t afterId = searchIndex.persistedMaxId();
+    while (true) {
+        auto [err, messages] = db->getTxtMessagesAfterId(afterId, IndexCatchUpBatch);
+        if ((err != MessengerDb::Error::Ok) || messages.empty()) {
+            break;
+        }
+        for (const auto& message : messages) {
+            searchIndex.add(message.chatId, message.id, message.message);
+        }
+        afterId = messages.back().id;
+    }
 }
 
-std::pair<bool, size_t> Api::userIsAuthenticated(const util::web::http::HttpRequest& request) {
-    auto cookies = request.headers.cookies();
-    std::string userId;
-    std::string authToken;
-    if (auto iter = cookies.find("userId"); iter != cookies.end()) {
-        userId = iter->second;
+std::vector<size_t> Api::chatParticipants(const db::Chat& chat) {
+    if (!chat.isGroup()) {
+        return { chat.whoId, chat.withId };
     }
-    if (auto iter = cookies.find("authToken"); iter != cookies.end()) {
-        authToken = iter->second;
+    if (auto members = sharedCache.chatMembers(chat.id); members) {
+        return *members;
     }
-    if (userId.empty() || authToken.empty()) return { false, 0 };
-    return { sharedCache.userIsAuthentificated(std::stoull(userId), authToken), std::stoull(userId) };
+    return { chat.whoId };
+}
+
+bool Api::ownsBlob(size_t userId, const std::string& hash) {
+    auto [err, owned] = db->getOwnedBlobs(userId, { hash });
+    return (err == MessengerDb::Error::Ok) && !owned.empty();
+}
+
+std::optional<std::unordered_set<std::string>> Api::referencedBlobs(const std::vector<std::string>& hashes) {
+    auto [err, referenced] = db->getReferencedBlobs(hashes);
+    if (err != MessengerDb::Error::Ok) {
+        return std::nullopt;
+    }
+    return std::unordered_set<std::string>(std::make_move_iterator(referenced.begin()), std::make_move_iterator(referenced.end()));
+}
+
+std::pair<bool, size_t> Api::userIsAuthenticated(const util::web::http::HttpRequest& request) {
+    TraceSpan span("auth");
+    // looking cookies up in place instead of building cookies map on every request
+    const auto& cookieHeader = request.headers.find("Cookie");
+    auto userId = findCookie(cookieHeader, "userId");
+    auto authToken = findCookie(cookieHeader, "authToken");
+    auto optUserId = parseId(userId);
+    if (!optUserId.has_value() || authToken.empty()) return { false, 0 };
+    return { sharedCache.userIsAuthentificated(optUserId.value(), authToken), optUserId.value() };
 }
 
 std::string Api::generateAuthToken(const std::string& username, const std::string& pwdHash) {
@@ -1,18 +1,27 @@
 #include "MessengerDb.hpp"
 #include "HttpServer.hpp"
 #include "SharedCache.hpp"
+#include "EventHub.hpp"
+#include "AdmissionControl.hpp"
+#include "SearchIndex.hpp"
+#include "BlobStore.hpp"
+#include "ChangeLog.hpp"
+#include "ClusterBus.hpp"
 #include "Http.hpp"
 #include "crypto.hpp"
 #include "Json.hpp"
 
 class Api {
 public:
-	Api(std::unique_ptr<db::MessengerDb> pdb);
+	Api(std::unique_ptr<db::MessengerDb> pdb, const std::filesystem::path& indexDir, const std::filesystem::path& storageDir, const std::filesystem::path& changeLogDir);
+	~Api();
+	// joins other server processes, events for users whose streams are held by them are forwarded there
+	void startCluster(size_t nodeId, std::vector<std::string> nodes);
 
 	/*
 		OPTIONS response for CORS request.
 	*/
-	util::web::http::HttpResponse onOptions(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse onOptions(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	//inline HttpServer& http() const { return HttpServer::get(); }
 	/*
@@ -26,7 +35,7 @@ public:
 		output:
 			cookies 'userId' and 'authToken'
 	*/
-	util::web::http::HttpResponse userRegisterOrLogin(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse userRegisterOrLogin(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		POST /user/logout
@@ -35,7 +44,7 @@ public:
 		output:
 			unsets cookies 'userId' and 'authToken'
 	*/
-	util::web::http::HttpResponse userLogout(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse userLogout(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		GET /user/find* (/user/find?username=neko)
@@ -47,7 +56,7 @@ public:
 		output:
 			userId - number
 	*/
-	util::web::http::HttpResponse userFind(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse userFind(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		POST /contact
@@ -62,7 +71,7 @@ public:
 					{addrBook}
 				}
 	*/
-	util::web::http::HttpResponse contactAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse contactAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		GET /contact
@@ -74,7 +83,7 @@ public:
 				users: {id1: username1, ,,,},
 			}
 	*/
-	util::web::http::HttpResponse contactsGetForId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse contactsGetForId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		DELETE /contact
@@ -86,7 +95,7 @@ public:
 		output:
 			empty
 	*/
-	util::web::http::HttpResponse contactDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse contactDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		POST /chat
@@ -101,7 +110,7 @@ public:
 					{chat}
 				}
 	*/
-	util::web::http::HttpResponse chatAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse chatAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		GET /chat
@@ -113,7 +122,7 @@ public:
 				users: {id1: username1, ,,,},
 			}
 	*/
-	util::web::http::HttpResponse chatsGetForId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse chatsGetForId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		DELETE /chat
@@ -125,7 +134,58 @@ public:
 		output:
 			empty
 	*/
-	util::web::http::HttpResponse chatDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse chatDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+
+	/*
+		POST /chat/group
+		input:
+			empty(cookies)
+		output:
+			json:
+				{
+					{chat}		(withId is 0, creator is whoId and the first member)
+				}
+	*/
+	util::web::http::HttpResponse chatGroupAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+
+	/*
+		POST /chat/member
+		only by creator of group chat
+		input:
+			json:
+				{
+					"chatId": N,
+					"userId": N
+				}
+		output:
+			empty
+	*/
+	util::web::http::HttpResponse chatMemberAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+
+	/*
+		GET /chat/member?chatId=N
+		input:
+			empty
+		output:
+			{
+				users: {id1: username1, ,,,},
+			}
+	*/
+	util::web::http::HttpResponse chatMembersGet(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+
+	/*
+		DELETE /chat/member
+		creator removes any member, member may remove only itself
+		input:
+			json:
+				{
+					"chatId": N,
+					"userId": N
+				}
+		output:
+			empty
+	*/
+	util::web::http::HttpResponse chatMemberDelete(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		POST /message
@@ -138,7 +198,7 @@ public:
 		output:
 			json txtMessage
 	*/
-	util::web::http::HttpResponse txtMessageAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse txtMessageAdd(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
 	/*
 		GET /message?chatId=N
@@ -150,21 +210,140 @@ public:
 				users: {id1: username1, ,,,},
 			}
 	*/
-	util::web::http::HttpResponse txtMessagesGetForChatId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse txtMessagesGetForChatId(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+
+	/*
+		GET /message/search?q=...&chatId=N&limit=N
+		input:
+			q - words to find, all of them should be in message
+			chatId - optional, searching in all chats of user if absent
+			limit - optional, max messages, 50 by default
+		output:
+			{
+				messages: {id:...,},		(newest first)
+				users: {id1: username1, ,,,},
+			}
+	*/
+	util::web::http::HttpResponse messageSearch(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+
+	/*
+		POST /batch
+		runs several read operations under one authentication
+		input:
+			json:
+				{
+					"ops": ["contacts", "chats", "messages:N", ...]		(at most 64 ops)
+				}
+		output:
+			{
+				"contacts": {status: 200, body: {same as GET /contact}},
+				"chats": {status: 200, body: {same as GET /chat}},
+				"messages:N": {status: 200, body: {same as GET /message?chatId=N}},
+				...
+			}
+			failed operation has only status
+	*/
+	util::web::http::HttpResponse batch(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
-	util::web::http::HttpResponse storageGet(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	/*
+		GET /bootstrap
+		input:
+			empty(cookies)
+		output:
+			{
+				contacts: {id:...,},
+				chats: {id:...,},
+				messages: {chatId: {id:...,},},		(latest page of each chat)
+				users: {id1: username1, ,,,},
+			}
+	*/
+	util::web::http::HttpResponse bootstrap(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+
+	/*
+		GET /sync?since=<cursor>
+		input:
+			since - cursor from previous /sync response
+		output:
+			{
+				"cursor": "...",
+				"more": false,		(true if there are more changes, request again with new cursor)
+				"changes": [
+					{"seq": N, "type": "contact.add|contact.delete|chat.add|chat.delete|message.add", "id": N, "data": {entry}},
+					...
+				]		(data only for adds)
+			}
+			410 with {"cursor": "..."} if since is absent or expired:
+				client should reload everything and continue from this cursor
+	*/
+	util::web::http::HttpResponse sync(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+
+	/*
+		GET /storage/<sha256>
+		input:
+			empty(cookies), If-None-Match
+		output:
+			blob content, cached as immutable
+		GET /storage/<path> of file stored before blobs is served as is, read-only;
+		404 for paths into storage/tmp and paths with '.' or '..' segments
+	*/
+	util::web::http::HttpResponse storageGet(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+
+	/*
+		POST /storage
+		input:
+			file content as body, up to 64MB
+			optional header X-Content-Sha256 - if this user has uploaded blob with this hash and it is still stored, body is ignored and may be empty
+		output:
+			json:
+				{
+					"url": "/storage/<sha256>",
+					"sha256": "...",
+					"size": N
+				}
+	*/
+	util::web::http::HttpResponse storageUpload(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
-	util::web::http::HttpResponse eventsSubscribe(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse eventsSubscribe(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 
-	util::web::http::HttpResponse echo(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
-	util::web::http::HttpResponse hello(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr);
+	util::web::http::HttpResponse echo(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
+	util::web::http::HttpResponse hello(const util::web::http::HttpRequest& request, HttpServer::CallbackMsgFn cbMsgFn = nullptr, size_t authUserId = 0);
 private:
 	util::web::http::HttpResponse response(const util::web::http::HttpRequest& request, size_t code, util::web::http::HttpHeaders&& headers = {}, std::string&& body = "");
+	// returns rejection response if request should not be handled
+	std::optional<util::web::http::HttpResponse> admit(const util::web::http::HttpRequest& request, size_t cost, size_t authUserId);
+	util::web::http::HttpResponse jsonResponse(const util::web::http::HttpRequest& request, size_t code, std::string&& body);
+	static void addCookies(util::web::http::HttpHeaders& headers, std::initializer_list<std::string> cookies);
+	// bodies of GET /contact, GET /chat and GET /message, shared with /batch
+	util::web::json::ObjNode contactsView(size_t userId);
+	util::web::json::ObjNode chatsView(size_t userId);
+	// returns nullopt if user is not a member of chat, throws on db error
+	std::optional<util::web::json::ObjNode> messagesView(size_t userId, size_t chatId);
+	// runs one /batch operation, returns status code and body
+	std::pair<size_t, std::optional<util::web::json::ObjNode>> batchOp(size_t userId, std::string_view op);
+	void registerGauges();
+	// emits event to local streams of users and forwards it to cluster nodes holding their other streams
+	void publish(const std::vector<size_t>& userIds, EventHub::EventPtr data, size_t exceptUserId = 0);
+	// users who see changes of chat
+	std::vector<size_t> chatParticipants(const db::Chat& chat);
+	// user has uploaded blob
+	bool ownsBlob(size_t userId, const std::string& hash);
+	// those of hashes that are referenced by messages, for blob collection
+	std::optional<std::unordered_set<std::string>> referencedBlobs(const std::vector<std::string>& hashes);
 	void onInit();
 	// returns is auth flag and user id
 	std::pair<bool, size_t> userIsAuthenticated(const util::web::http::HttpRequest& request);
 	std::string generateAuthToken(const std::string& username, const std::string& pwdHash);
 	std::unique_ptr<db::MessengerDb> db;
 	SharedCache sharedCache;
+	EventHub eventHub;
+	// declared after eventHub, so it is stopped before hub it delivers to;
+	// hub reports presence to it until destructor of Api clears presence handler
+	std::unique_ptr<ClusterBus> clusterBus;
+	AdmissionControl admission;
+	SearchIndex searchIndex;
+	BlobStore blobStore;
+	ChangeLog changeLog;
 	std::function<std::pair<std::string, util::web::json::Node>(const db::User&)> usernameByIdExtractor;
+	// latency histogram ids, by index in routes table
+	std::vector<size_t> routeLatencyMetrics;
 };
\ No newline at end of file
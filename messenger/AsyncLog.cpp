@@ -0,0 +1,99 @@
+#include "AsyncLog.hpp"
+#include <chrono>
+#include "ProjLogger.hpp"
+
+LogStr::LogStr(std::string_view s) {
+	if (s.size() <= sizeof(data)) {
+		size = (uint8_t)s.size();
+		std::memcpy(data, s.data(), size);
+		return;
+	}
+	size_t keep = sizeof(data) - TruncatedMark.size();
+	std::memcpy(data, s.data(), keep);
+	std::memcpy(data + keep, TruncatedMark.data(), TruncatedMark.size());
+	size = (uint8_t)sizeof(data);
+}
+
+AsyncLog& AsyncLog::get() {
+	static AsyncLog log;
+	return log;
+}
+
+AsyncLog::~AsyncLog() {
+	stop();
+}
+
+void AsyncLog::start(Policy _policy) {
+	if (running.load(std::memory_order_acquire)) {
+		return;
+	}
+	// published by release store below, producers read it only after seeing running
+	policy = _policy;
+	running.store(true, std::memory_order_release);
+	worker = std::thread([this]() { run(); });
+}
+
+void AsyncLog::stop() {
+	if (!running.exchange(false)) {
+		return;
+	}
+	if (worker.joinable()) {
+		worker.join();
+	}
+	// records pushed while worker was stopping
+	std::string buf;
+	drain(buf);
+}
+
+std::string AsyncLog::badRecord(const char* fmt, const std::exception& ex) {
+	return std::format("unformattable log record \"{}\": {}", fmt, ex.what());
+}
+
+AsyncLog::Ring& AsyncLog::threadRing() {
+	thread_local std::shared_ptr<Ring> ring;
+	if (!ring) {
+		ring = std::make_shared<Ring>();
+		std::unique_lock<std::mutex> lck{ ringsMtx };
+		rings.push_back(ring);
+	}
+	return *ring;
+}
+
+void AsyncLog::write(Level level, const std::string& msg) {
+	switch (level) {
+	case Level::Debug: Log.debug(msg); break;
+	case Level::Info: Log.info(msg); break;
+	case Level::Error: Log.error(msg); break;
+	}
+}
+
+void AsyncLog::run() {
+	std::string buf;
+	size_t reportedDropped = 0;
+	while (running.load(std::memory_order_relaxed)) {
+		if (!drain(buf)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		if (size_t curDropped = dropped(); curDropped != reportedDropped) {
+			Log.error(std::format("log rings overflowed, {} records dropped", curDropped - reportedDropped));
+			reportedDropped = curDropped;
+		}
+	}
+}
+
+size_t AsyncLog::drain(std::string& buf) {
+	std::vector<std::shared_ptr<Ring>> curRings;
+	{
+		std::unique_lock<std::mutex> lck{ ringsMtx };
+		curRings = rings;
+	}
+	size_t cnt = 0;
+	for (auto& ring : curRings) {
+		cnt += ring->consumeAll([this, &buf](Record& record) {
+			buf.clear();
+			record.format(record, buf);
+			write(record.level, buf);
+			});
+	}
+	return cnt;
+}
@@ -0,0 +1,207 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/*
+	Minimal level that is logged: 0 - debug, 1 - info, 2 - error.
+	Log calls below it compile to nothing.
+*/
+#ifndef ASYNC_LOG_LEVEL
+#define ASYNC_LOG_LEVEL 1
+#endif
+
+// copy of dynamic string argument, truncated to fit into log record, cut string ends with TruncatedMark
+struct LogStr {
+	static constexpr std::string_view TruncatedMark = "...[truncated]";
+	LogStr(std::string_view s);
+	std::string_view view() const { return { data, size }; }
+	char data[200];
+	uint8_t size = 0;
+};
+
+template<>
+struct std::formatter<LogStr> : std::formatter<std::string_view> {
+	auto format(const LogStr& s, std::format_context& ctx) const {
+		return std::formatter<std::string_view>::format(s.view(), ctx);
+	}
+};
+
+/*
+	Asynchronous front-end for ProjLogger.
+	Every thread pushes records into its own lock-free single producer ring.
+	Records keep format string pointer and binary copies of arguments,
+	formatting and writing to Log happens on background thread.
+	Format strings should be literals - only pointer to them is stored.
+*/
+class AsyncLog {
+public:
+	enum class Level {
+		Debug,
+		Info,
+		Error
+	};
+
+	// what to do when calling thread's ring is full
+	enum class Policy {
+		Drop,
+		Block
+	};
+
+	static constexpr size_t RingCapacity = 1024;
+	static constexpr size_t PayloadSize = 232;
+
+	static AsyncLog& get();
+	~AsyncLog();
+
+	void start(Policy policy);
+	void stop();
+
+	template<Level Lvl, typename... Args>
+	void log(const char* fmt, const Args&... args);
+	inline size_t dropped() const { return droppedCnt.load(std::memory_order_relaxed); }
+
+private:
+	struct Record {
+		Level level;
+		void (*format)(Record& record, std::string& out);
+		alignas(std::max_align_t) std::byte payload[PayloadSize];
+	};
+
+	class Ring {
+	public:
+		// fill constructs record in place, returns false if ring is full
+		template<typename F>
+		bool tryPush(F&& fill);
+		// calls fn for every record pushed so far, returns number of consumed records
+		template<typename F>
+		size_t consumeAll(F&& fn);
+	private:
+		std::array<Record, RingCapacity> records;
+		alignas(64) std::atomic<size_t> head{ 0 };
+		alignas(64) std::atomic<size_t> tail{ 0 };
+	};
+
+	template<typename T>
+	using Captured = std::conditional_t<std::is_convertible_v<const T&, std::string_view>, LogStr, std::decay_t<T>>;
+
+	template<typename... Args>
+	struct Payload {
+		const char* fmt;
+		std::tuple<Args...> args;
+	};
+
+	AsyncLog() = default;
+	template<typename... Args>
+	static void formatRecord(Record& record, std::string& out);
+	// placeholder message of record which format string doesn't match its arguments
+	static std::string badRecord(const char* fmt, const std::exception& ex);
+	Ring& threadRing();
+	void write(Level level, const std::string& msg);
+	void run();
+	size_t drain(std::string& buf);
+
+	Policy policy = Policy::Drop;
+	std::atomic<bool> running{ false };
+	std::atomic<size_t> droppedCnt{ 0 };
+	std::mutex ringsMtx;
+	std::vector<std::shared_ptr<Ring>> rings;
+	std::thread worker;
+};
+
+template<typename F>
+bool AsyncLog::Ring::tryPush(F&& fill) {
+	size_t t = tail.load(std::memory_order_relaxed);
+	if (t - head.load(std::memory_order_acquire) == RingCapacity) {
+		return false;
+	}
+	fill(records[t % RingCapacity]);
+	tail.store(t + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename F>
+size_t AsyncLog::Ring::consumeAll(F&& fn) {
+	size_t h = head.load(std::memory_order_relaxed);
+	size_t t = tail.load(std::memory_order_acquire);
+	for (size_t i = h; i != t; ++i) {
+		fn(records[i % RingCapacity]);
+	}
+	head.store(t, std::memory_order_release);
+	return t - h;
+}
+
+template<typename... Args>
+void AsyncLog::formatRecord(Record& record, std::string& out) {
+	auto* payload = std::launder(reinterpret_cast<Payload<Args...>*>(record.payload));
+	try {
+		std::apply([&](const auto&... args) { std::vformat_to(std::back_inserter(out), payload->fmt, std::make_format_args(args...)); }, payload->args);
+	}
+	catch (const std::exception& ex) {
+		// format string is checked only at runtime, bad one should not take the process down
+		out = badRecord(payload->fmt, ex);
+	}
+	payload->~Payload<Args...>();
+}
+
+template<AsyncLog::Level Lvl, typename... Args>
+void AsyncLog::log(const char* fmt, const Args&... args) {
+	if constexpr ((int)Lvl >= ASYNC_LOG_LEVEL) {
+		using PayloadT = Payload<Captured<Args>...>;
+		static_assert(sizeof(PayloadT) <= PayloadSize, "too many log arguments");
+		static_assert((std::is_trivially_destructible_v<Captured<Args>> && ...), "log arguments should be plain values or strings");
+		if (!running.load(std::memory_order_acquire)) {
+			std::string msg;
+			try {
+				msg = std::vformat(fmt, std::make_format_args(args...));
+			}
+			catch (const std::exception& ex) {
+				msg = badRecord(fmt, ex);
+			}
+			write(Lvl, msg);
+			return;
+		}
+		auto fill = [&](Record& record) {
+			record.level = Lvl;
+			record.format = &formatRecord<Captured<Args>...>;
+			new (record.payload) PayloadT{ fmt, std::tuple<Captured<Args>...>(Captured<Args>(args)...) };
+		};
+		Ring& ring = threadRing();
+		while (!ring.tryPush(fill)) {
+			// nobody is going to free space after stop
+			if ((policy == Policy::Drop) || !running.load(std::memory_order_acquire)) {
+				droppedCnt.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			std::this_thread::yield();
+		}
+	}
+}
+
+namespace alog {
+
+	template<typename... Args>
+	inline void debug(const char* fmt, const Args&... args) { AsyncLog::get().log<AsyncLog::Level::Debug>(fmt, args...); }
+
+	template<typename... Args>
+	inline void info(const char* fmt, const Args&... args) { AsyncLog::get().log<AsyncLog::Level::Info>(fmt, args...); }
+
+	template<typename... Args>
+	inline void error(const char* fmt, const Args&... args) { AsyncLog::get().log<AsyncLog::Level::Error>(fmt, args...); }
+
+}
@@ -0,0 +1,150 @@
+#include "BlobStore.hpp"
+#include <algorithm>
+#include <format>
+#include "AsyncLog.hpp"
+
+BlobStore::BlobStore(const std::filesystem::path& _root, ReferencedFn _referenced)
+	: root{ _root }, referenced{ std::move(_referenced) }
+{
+	std::filesystem::create_directories(root / TmpDir);
+	// uploads interrupted by restart
+	for (const auto& entry : std::filesystem::directory_iterator(root / TmpDir)) {
+		std::error_code ec;
+		std::filesystem::remove(entry.path(), ec);
+	}
+	gc = std::thread([this]() { run(); });
+}
+
+BlobStore::~BlobStore() {
+	{
+		std::unique_lock<std::mutex> lck{ mtx };
+		stopped = true;
+	}
+	cv.notify_one();
+	gc.join();
+}
+
+bool BlobStore::isHash(std::string_view s) {
+	return (s.size() == 64) && std::all_of(s.begin(), s.end(), [](char c) { return ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'f')); });
+}
+
+std::string BlobStore::relativePath(std::string_view hash) {
+	return std::format("{}/{}/{}", hash.substr(0, 2), hash.substr(2, 2), hash);
+}
+
+bool BlobStore::isLegacyPath(std::string_view relative) {
+	if (relative.empty() || relative.starts_with('/')) {
+		return false;
+	}
+	for (size_t pos = 0; pos <= relative.size();) {
+		size_t end = std::min(relative.find('/', pos), relative.size());
+		std::string_view segment = relative.substr(pos, end - pos);
+		if (segment.empty() || (segment == ".") || (segment == "..") || ((pos == 0) && (segment == TmpDir))) {
+			return false;
+		}
+		pos = end + 1;
+	}
+	return true;
+}
+
+std::filesystem::path BlobStore::path(std::string_view hash) const {
+	return root / relativePath(hash);
+}
+
+bool BlobStore::contains(std::string_view hash) const {
+	std::error_code ec;
+	return isHash(hash) && std::filesystem::is_regular_file(path(hash), ec);
+}
+
+bool BlobStore::touch(std::string_view hash) {
+	std::unique_lock<std::mutex> lck{ blobsMtx };
+	return touchLocked(hash);
+}
+
+bool BlobStore::touchLocked(std::string_view hash) {
+	if (!isHash(hash)) {
+		return false;
+	}
+	std::error_code ec;
+	std::filesystem::last_write_time(path(hash), std::filesystem::file_time_type::clock::now(), ec);
+	return !ec;
+}
+
+UploadSink BlobStore::sink(size_t maxSize) const {
+	// same filesystem as blobs, so commit is a rename
+	return UploadSink(root / TmpDir, maxSize);
+}
+
+std::optional<std::string> BlobStore::put(UploadSink& sink) {
+	auto optHash = sink.finish();
+	if (!optHash.has_value()) {
+		return std::nullopt;
+	}
+	const auto& hash = optHash.value();
+	std::unique_lock<std::mutex> lck{ blobsMtx };
+	if (touchLocked(hash)) {
+		sink.discard();
+		return optHash;
+	}
+	std::error_code ec;
+	std::filesystem::create_directories(path(hash).parent_path(), ec);
+	if (ec || !sink.commit(path(hash))) {
+		return std::nullopt;
+	}
+	return optHash;
+}
+
+size_t BlobStore::collect() {
+	// blobs are listed before references are read, so blob referenced in between is not removed
+	std::vector<std::string> candidates;
+	auto deadline = std::filesystem::file_time_type::clock::now() - GcGrace;
+	for (auto iter = std::filesystem::recursive_directory_iterator(root); iter != std::filesystem::recursive_directory_iterator(); ++iter) {
+		if (iter->is_directory() && (iter.depth() == 0) && (iter->path().filename() == TmpDir)) {
+			iter.disable_recursion_pending();
+			continue;
+		}
+		if (iter->is_regular_file() && (iter.depth() == 2) && isHash(iter->path().filename().string()) && (iter->last_write_time() < deadline)) {
+			candidates.push_back(iter->path().filename().string());
+		}
+	}
+	size_t removed = 0;
+	// references are read in small batches, each query holds db connection shortly
+	for (size_t pos = 0; pos < candidates.size(); pos += GcBatch) {
+		std::vector<std::string> batch(candidates.begin() + pos, candidates.begin() + std::min(pos + GcBatch, candidates.size()));
+		auto optReferenced = referenced(batch);
+		if (!optReferenced.has_value()) {
+			break;
+		}
+		for (const auto& hash : batch) {
+			if (optReferenced->contains(hash)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lck{ blobsMtx };
+			std::error_code ec;
+			// touched or uploaded again after it was listed
+			if ((std::filesystem::last_write_time(path(hash), ec) >= deadline) || ec) {
+				continue;
+			}
+			if (std::filesystem::remove(path(hash), ec)) {
+				++removed;
+			}
+		}
+	}
+	return removed;
+}
+
+void BlobStore::run() {
+	std::unique_lock<std::mutex> lck{ mtx };
+	while (!cv.wait_for(lck, GcInterval, [this]() { return stopped; })) {
+		lck.unlock();
+		try {
+			if (size_t removed = collect(); removed) {
+				alog::info("Removed {} unreferenced blobs", removed);
+			}
+		}
+		catch (std::exception& ex) {
+			alog::error("blob gc: {}", ex.what());
+		}
+		lck.lock();
+	}
+}
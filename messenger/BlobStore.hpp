@@ -0,0 +1,68 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "UploadSink.hpp"
+
+/*
+	Content addressed storage of uploaded files: every blob is named by sha256 of its content
+	and lives in root/ab/cd/<hash>, so directories stay small. Equal uploads are stored once.
+	Blobs are immutable, references to them are kept by caller (messages in db).
+	Background thread removes blobs that are not referenced and were not touched for grace period,
+	so fresh uploads survive until message referencing them is sent.
+	Files stored before blobs keep their paths, they are served read-only and never collected.
+*/
+class BlobStore {
+public:
+	// returns those of hashes that are referenced, nullopt if it is unknown now (collection is stopped)
+	using ReferencedFn = std::function<std::optional<std::unordered_set<std::string>>(const std::vector<std::string>& hashes)>;
+
+	static constexpr std::chrono::seconds GcGrace{ 3600 };
+	static constexpr std::chrono::seconds GcInterval{ 600 };
+	static constexpr char TmpDir[] = "tmp";
+	// candidates checked for references by one query
+	static constexpr size_t GcBatch = 500;
+
+	BlobStore(const std::filesystem::path& root, ReferencedFn referenced);
+	~BlobStore();
+	BlobStore(const BlobStore&) = delete;
+	BlobStore& operator=(const BlobStore&) = delete;
+
+	// true if s is lowercase hex sha256
+	static bool isHash(std::string_view s);
+	// path relative to root, e.g. "ab/cd/abcd..."
+	static std::string relativePath(std::string_view hash);
+	// true if relative path may name file stored before blobs: not in tmp dir, no empty, '.' or '..' segments
+	static bool isLegacyPath(std::string_view relative);
+	std::filesystem::path path(std::string_view hash) const;
+	bool contains(std::string_view hash) const;
+	// marks blob as used now, protecting it from collection for grace period; false if there is no such blob
+	bool touch(std::string_view hash);
+
+	UploadSink sink(size_t maxSize) const;
+	// finishes upload and stores it, returns hash; if blob already exists, upload is dropped
+	std::optional<std::string> put(UploadSink& sink);
+	// removes unreferenced blobs older than grace period, returns removed count
+	size_t collect();
+
+private:
+	bool touchLocked(std::string_view hash);
+	void run();
+
+	const std::filesystem::path root;
+	ReferencedFn referenced;
+	// orders collection of blob with its touch() and put(), so blob used after it was found old is kept
+	std::mutex blobsMtx;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopped = false;
+	std::thread gc;
+};
@@ -0,0 +1,282 @@
+#include "ChangeLog.hpp"
+#include <charconv>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include "profiling.hpp"
+
+namespace {
+
+	void writeChange(std::ofstream& out, const ChangeLog::Change& change) {
+		uint64_t seq = change.seq;
+		uint8_t kind = (uint8_t)change.kind;
+		uint64_t id = change.id;
+		uint32_t size = change.data ? (uint32_t)change.data->size() : 0;
+		out.write(reinterpret_cast<const char*>(&seq), sizeof(seq));
+		out.write(reinterpret_cast<const char*>(&kind), sizeof(kind));
+		out.write(reinterpret_cast<const char*>(&id), sizeof(id));
+		out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		if (size) {
+			out.write(change.data->data(), size);
+		}
+	}
+
+	// withData = false skips data, e.g. when only seqs are needed
+	bool readChange(std::ifstream& in, ChangeLog::Change& change, bool withData = true) {
+		uint64_t seq = 0;
+		uint8_t kind = 0;
+		uint64_t id = 0;
+		uint32_t size = 0;
+		in.read(reinterpret_cast<char*>(&seq), sizeof(seq));
+		in.read(reinterpret_cast<char*>(&kind), sizeof(kind));
+		in.read(reinterpret_cast<char*>(&id), sizeof(id));
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		if (!in) {
+			return false;
+		}
+		change.seq = seq;
+		change.kind = (ChangeLog::Kind)kind;
+		change.id = id;
+		change.data = nullptr;
+		if (!withData) {
+			in.seekg(size, std::ios::cur);
+			return (bool)in;
+		}
+		if (size) {
+			std::string data(size, '\0');
+			in.read(data.data(), size);
+			change.data = std::make_shared<const std::string>(std::move(data));
+		}
+		return (bool)in;
+	}
+
+}
+
+ChangeLog::ChangeLog(const std::filesystem::path& _dir)
+	: dir{ _dir }, epoch{ util::prof::tsMs() }
+{
+	std::filesystem::create_directories(dir);
+	// cursors of previous run are expired anyway
+	for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+		if ((entry.path().extension() == ".log") || (entry.path().extension() == ".tmp")) {
+			std::filesystem::remove(entry.path());
+		}
+	}
+}
+
+void ChangeLog::add(size_t userId, Kind kind, size_t id, DataPtr data) {
+	auto [log, lck] = userLog(userId);
+	addLocked(userId, *log, kind, id, std::move(data));
+}
+
+void ChangeLog::add(const std::vector<size_t>& userIds, Kind kind, size_t id, DataPtr data) {
+	for (auto userId : userIds) {
+		add(userId, kind, id, data);
+	}
+}
+
+std::string ChangeLog::cursor(size_t userId) {
+	auto [log, lck] = userLog(userId);
+	return format(log->nextSeq - 1);
+}
+
+std::optional<ChangeLog::Delta> ChangeLog::since(size_t userId, std::string_view cursor, size_t limit) {
+	size_t cursorEpoch = 0;
+	size_t seq = 0;
+	auto [ptr, ec] = std::from_chars(cursor.data(), cursor.data() + cursor.size(), cursorEpoch);
+	if ((ec != std::errc()) || (ptr == cursor.data() + cursor.size()) || (*ptr != '-') || (cursorEpoch != epoch)) {
+		return std::nullopt;
+	}
+	auto [seqPtr, seqEc] = std::from_chars(ptr + 1, cursor.data() + cursor.size(), seq);
+	if ((seqEc != std::errc()) || (seqPtr != cursor.data() + cursor.size())) {
+		return std::nullopt;
+	}
+	auto [logPtr, lck] = userLog(userId);
+	auto& log = *logPtr;
+	size_t lastSeq = log.nextSeq - 1;
+	size_t oldestSeq = log.diskCount ? log.diskFirstSeq : (log.memory.empty() ? log.nextSeq : log.memory.front().seq);
+	// cursor from future or changes after it are not kept anymore
+	if ((seq > lastSeq) || (seq + 1 < oldestSeq)) {
+		return std::nullopt;
+	}
+	Delta delta;
+	size_t memoryFirstSeq = log.memory.empty() ? log.nextSeq : log.memory.front().seq;
+	if (seq + 1 < memoryFirstSeq) {
+		delta.changes = readDisk(userId, seq, limit + 1);
+	}
+	for (const auto& change : log.memory) {
+		if (delta.changes.size() > limit) {
+			break;
+		}
+		if (change.seq > seq) {
+			delta.changes.push_back(change);
+		}
+	}
+	// one more change than limit was read to know if there are more
+	if (delta.changes.size() > limit) {
+		delta.changes.resize(limit);
+		delta.more = true;
+	}
+	delta.cursor = format(delta.changes.empty() ? seq : delta.changes.back().seq);
+	return delta;
+}
+
+const char* ChangeLog::kindName(Kind kind) {
+	switch (kind) {
+	case Kind::ContactAdd: return "contact.add";
+	case Kind::ContactDelete: return "contact.delete";
+	case Kind::ChatAdd: return "chat.add";
+	case Kind::ChatDelete: return "chat.delete";
+	case Kind::MessageAdd: return "message.add";
+	default: return "unknown";
+	}
+}
+
+std::pair<std::shared_ptr<ChangeLog::UserLog>, std::unique_lock<std::mutex>> ChangeLog::userLog(size_t userId) {
+	std::shared_ptr<UserLog> log;
+	size_t nowMs = util::prof::tsMs();
+	bool evict = false;
+	{
+		std::unique_lock<std::mutex> lck{ mtx };
+		if (nowMs >= lastEvictCheckMs + EvictCheckIntervalMs) {
+			lastEvictCheckMs = nowMs;
+			evict = true;
+		}
+		auto& entry = logs[userId];
+		if (!entry) {
+			entry = std::make_shared<UserLog>();
+		}
+		entry->lastUseMs = nowMs;
+		log = entry;
+	}
+	if (evict) {
+		evictIdle(nowMs);
+	}
+	std::unique_lock<std::mutex> logLck{ log->mtx };
+	if (!log->loaded) {
+		loadLocked(userId, *log);
+	}
+	return { std::move(log), std::move(logLck) };
+}
+
+void ChangeLog::evictIdle(size_t nowMs) {
+	std::vector<std::pair<size_t, std::shared_ptr<UserLog>>> idle;
+	{
+		std::unique_lock<std::mutex> lck{ mtx };
+		for (const auto& [userId, log] : logs) {
+			if (idle.size() == MaxEvictsPerCheck) {
+				break;
+			}
+			// copies are made only under mtx, so log with single owner is not used by anybody now
+			if ((log.use_count() == 1) && (nowMs >= log->lastUseMs + IdleEvictMs)) {
+				idle.emplace_back(userId, log);
+			}
+		}
+	}
+	// logs stay in map while spilled, so their users wait for log mutex instead of loading file being written
+	for (auto& [userId, log] : idle) {
+		std::unique_lock<std::mutex> logLck{ log->mtx };
+		if (!log->memory.empty()) {
+			spillLocked(userId, *log, log->memory.size());
+		}
+	}
+	std::unique_lock<std::mutex> lck{ mtx };
+	for (const auto& [userId, log] : idle) {
+		// log taken after it was collected keeps its place, its changes are on disk already
+		if ((log.use_count() == 2) && (nowMs >= log->lastUseMs + IdleEvictMs)) {
+			logs.erase(userId);
+		}
+	}
+}
+
+void ChangeLog::loadLocked(size_t userId, UserLog& log) {
+	log.loaded = true;
+	std::ifstream in(filePath(userId), std::ios::binary);
+	Change change;
+	while (readChange(in, change, false)) {
+		if (!log.diskCount) {
+			log.diskFirstSeq = change.seq;
+		}
+		++log.diskCount;
+		log.nextSeq = change.seq + 1;
+	}
+}
+
+void ChangeLog::addLocked(size_t userId, UserLog& log, Kind kind, size_t id, DataPtr data) {
+	log.memory.push_back(Change{ log.nextSeq++, kind, id, std::move(data) });
+	if (log.memory.size() > MemoryCapacity) {
+		// older half goes to disk, so file is appended once per MemoryCapacity / 2 changes
+		spillLocked(userId, log, log.memory.size() / 2);
+	}
+}
+
+void ChangeLog::spillLocked(size_t userId, UserLog& log, size_t count) {
+	{
+		std::ofstream out(filePath(userId), std::ios::binary | std::ios::app);
+		for (size_t i = 0; i < count; ++i) {
+			writeChange(out, log.memory[i]);
+		}
+		if (!out) {
+			// changes are lost, clients with older cursors will resync
+			log.diskFirstSeq = 0;
+			log.diskCount = 0;
+			std::error_code ec;
+			std::filesystem::remove(filePath(userId), ec);
+			log.memory.erase(log.memory.begin(), log.memory.begin() + count);
+			return;
+		}
+	}
+	if (!log.diskCount) {
+		log.diskFirstSeq = log.memory.front().seq;
+	}
+	log.diskCount += count;
+	log.memory.erase(log.memory.begin(), log.memory.begin() + count);
+	if (log.diskCount > DiskCapacity) {
+		compactLocked(userId, log);
+	}
+}
+
+void ChangeLog::compactLocked(size_t userId, UserLog& log) {
+	// keeping latest half of capacity, so compaction is rare
+	size_t keepFromSeq = log.diskFirstSeq + log.diskCount - DiskCapacity / 2;
+	auto changes = readDisk(userId, keepFromSeq - 1, DiskCapacity);
+	auto path = filePath(userId);
+	auto tmpPath = path;
+	tmpPath += ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		for (const auto& change : changes) {
+			writeChange(out, change);
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, path, ec);
+	if (ec || changes.empty()) {
+		std::filesystem::remove(path, ec);
+		log.diskFirstSeq = 0;
+		log.diskCount = 0;
+		return;
+	}
+	log.diskFirstSeq = changes.front().seq;
+	log.diskCount = changes.size();
+}
+
+std::vector<ChangeLog::Change> ChangeLog::readDisk(size_t userId, size_t afterSeq, size_t limit) {
+	std::vector<Change> res;
+	std::ifstream in(filePath(userId), std::ios::binary);
+	Change change;
+	while ((res.size() < limit) && readChange(in, change)) {
+		if (change.seq > afterSeq) {
+			res.push_back(std::move(change));
+		}
+	}
+	return res;
+}
+
+std::string ChangeLog::format(size_t seq) const {
+	return std::format("{}-{}", epoch, seq);
+}
+
+std::filesystem::path ChangeLog::filePath(size_t userId) const {
+	return dir / std::format("{}.log", userId);
+}
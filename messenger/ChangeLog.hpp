@@ -0,0 +1,112 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Ordered per-user log of changes (adds and deletes of contacts, chats and messages),
+	so reconnected client fetches only what changed since its cursor instead of whole state.
+	Latest changes of every user are in memory, older ones are spilled to per-user file,
+	which is compacted to DiskCapacity latest changes. Cursor older than that is expired
+	and client should reload everything.
+	Cursor is "<epoch>-<seq>" like SSE ids, log is not kept between runs, so cursors of previous run are expired too.
+	Log of user idle for IdleEvictMs is moved to disk entirely and dropped from memory,
+	it is read back from file on next access, so its cursors stay valid.
+*/
+class ChangeLog {
+public:
+	// encoded json shared by logs of all users who got the change
+	using DataPtr = std::shared_ptr<const std::string>;
+
+	enum class Kind : uint8_t {
+		ContactAdd,
+		ContactDelete,
+		ChatAdd,
+		ChatDelete,
+		MessageAdd
+	};
+
+	struct Change {
+		size_t seq = 0;
+		Kind kind = Kind::ContactAdd;
+		// id of contact, chat or message
+		size_t id = 0;
+		// encoded json of added entry, nullptr for deletes
+		DataPtr data;
+	};
+
+	struct Delta {
+		std::vector<Change> changes;
+		// cursor for next request
+		std::string cursor;
+		// true if there are more changes than limit
+		bool more = false;
+	};
+
+	// changes of one user kept in memory, older are spilled to disk
+	static constexpr size_t MemoryCapacity = 128;
+	// changes of one user kept on disk
+	static constexpr size_t DiskCapacity = 4096;
+	static constexpr size_t IdleEvictMs = 10 * 60 * 1000;
+	static constexpr size_t EvictCheckIntervalMs = 10 * 1000;
+	// bounds work of one eviction pass, it is done by request that happened to trigger it
+	static constexpr size_t MaxEvictsPerCheck = 256;
+
+	ChangeLog(const std::filesystem::path& dir);
+	ChangeLog(const ChangeLog&) = delete;
+	ChangeLog& operator=(const ChangeLog&) = delete;
+
+	void add(size_t userId, Kind kind, size_t id, DataPtr data = nullptr);
+	// adds the same change to every user, e.g. participants of chat
+	void add(const std::vector<size_t>& userIds, Kind kind, size_t id, DataPtr data = nullptr);
+	// cursor pointing after the latest change of user
+	std::string cursor(size_t userId);
+	// returns changes after cursor, up to limit; nullopt if cursor is expired or invalid
+	std::optional<Delta> since(size_t userId, std::string_view cursor, size_t limit);
+
+	static const char* kindName(Kind kind);
+
+private:
+	struct UserLog {
+		std::mutex mtx;
+		size_t nextSeq = 1;
+		std::deque<Change> memory;
+		// seq of the oldest change on disk, 0 if nothing is spilled
+		size_t diskFirstSeq = 0;
+		size_t diskCount = 0;
+		// false until state of evicted log is read back from its file
+		bool loaded = false;
+		// guarded by ChangeLog::mtx
+		size_t lastUseMs = 0;
+	};
+
+	// returned log is loaded and locked
+	std::pair<std::shared_ptr<UserLog>, std::unique_lock<std::mutex>> userLog(size_t userId);
+	// spills idle logs without holding mtx, then drops those nobody used meanwhile
+	void evictIdle(size_t nowMs);
+	void loadLocked(size_t userId, UserLog& log);
+	void addLocked(size_t userId, UserLog& log, Kind kind, size_t id, DataPtr data);
+	// moves count oldest changes from memory to disk
+	void spillLocked(size_t userId, UserLog& log, size_t count);
+	void compactLocked(size_t userId, UserLog& log);
+	// reads changes with seq > afterSeq from user file
+	std::vector<Change> readDisk(size_t userId, size_t afterSeq, size_t limit);
+	std::string format(size_t seq) const;
+	std::filesystem::path filePath(size_t userId) const;
+
+	const std::filesystem::path dir;
+	// distinguishes cursors of this process from cursors of previous runs
+	const size_t epoch;
+	std::mutex mtx;
+	// log is evicted only when nobody else holds it
+	std::unordered_map<size_t, std::shared_ptr<UserLog>> logs;
+	size_t lastEvictCheckMs = 0;
+};
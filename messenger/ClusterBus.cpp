@@ -0,0 +1,451 @@
+#include "ClusterBus.hpp"
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "AsyncLog.hpp"
+
+namespace {
+	// frame is u32 length of the rest, u8 type and payload, integers are in host byte order - peers are on the same host
+	constexpr size_t FrameHeaderSize = sizeof(uint32_t) + sizeof(uint8_t);
+	constexpr size_t ReadChunkSize = 64 * 1024;
+	constexpr size_t NoNode = (size_t)-1;
+
+	sockaddr_un makeAddress(const std::string& path) {
+		sockaddr_un addr{};
+		if (path.size() >= sizeof(addr.sun_path)) {
+			throw std::runtime_error(std::format("cluster socket path is too long: {}", path));
+		}
+		addr.sun_family = AF_UNIX;
+		std::memcpy(addr.sun_path, path.data(), path.size());
+		return addr;
+	}
+
+	bool writeAll(int fd, std::string_view data) {
+		while (!data.empty()) {
+			auto written = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			data.remove_prefix((size_t)written);
+		}
+		return true;
+	}
+
+	template<typename T>
+	T readInt(std::string_view data) {
+		T value;
+		std::memcpy(&value, data.data(), sizeof(T));
+		return value;
+	}
+}
+
+ClusterBus::ClusterBus(size_t _nodeId, std::vector<std::string> _nodes, DeliverFn _deliver)
+	: nodeId{ _nodeId }, nodes{ std::move(_nodes) }, deliver{ std::move(_deliver) }
+{
+	if ((nodes.size() > MaxNodes) || (nodeId >= nodes.size())) {
+		throw std::runtime_error(std::format("invalid cluster node {} of {}", nodeId, nodes.size()));
+	}
+	auto addr = makeAddress(nodes[nodeId]);
+	// socket file of previous run
+	::unlink(nodes[nodeId].c_str());
+	listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	// nobody can connect before listen, so there is no window with default permissions
+	if ((listenFd < 0)
+		|| (::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0)
+		|| (::chmod(nodes[nodeId].c_str(), S_IRUSR | S_IWUSR) != 0)
+		|| (::listen(listenFd, (int)MaxNodes) != 0))
+	{
+		int err = errno;
+		if (listenFd >= 0) {
+			::close(listenFd);
+		}
+		throw std::runtime_error(std::format("can't listen on cluster socket {}: {}", nodes[nodeId], std::strerror(err)));
+	}
+	nodeReaderFds.assign(nodes.size(), -1);
+	peers.resize(nodes.size());
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		if (i == nodeId) {
+			continue;
+		}
+		peers[i] = std::make_unique<Peer>();
+		peers[i]->nodeId = i;
+		peers[i]->path = nodes[i];
+	}
+	listener = std::thread([this]() { listenerRun(); });
+	for (auto& peer : peers) {
+		if (peer) {
+			peer->writer = std::thread([this, &peer = *peer]() { writerRun(peer); });
+		}
+	}
+}
+
+ClusterBus::~ClusterBus() {
+	{
+		std::unique_lock<std::mutex> lck{ mtx };
+		stopped = true;
+		for (auto& peer : peers) {
+			if (peer && (peer->fd >= 0)) {
+				// unblocks send to stuck peer
+				::shutdown(peer->fd, SHUT_RDWR);
+			}
+		}
+	}
+	for (auto& peer : peers) {
+		if (peer) {
+			peer->cv.notify_one();
+			peer->writer.join();
+		}
+	}
+	// wakes up accept
+	::shutdown(listenFd, SHUT_RDWR);
+	listener.join();
+	::close(listenFd);
+	::unlink(nodes[nodeId].c_str());
+	{
+		std::unique_lock<std::mutex> lck{ readersMtx };
+		for (auto fd : readerFds) {
+			::shutdown(fd, SHUT_RDWR);
+		}
+	}
+	for (auto& [readerId, reader] : readers) {
+		reader.join();
+	}
+}
+
+void ClusterBus::userOnline(size_t userId) {
+	std::unique_lock<std::mutex> lck{ mtx };
+	if (localUsers.insert(userId).second) {
+		broadcastLocked(FrameType::Online, userId);
+	}
+}
+
+void ClusterBus::userOffline(size_t userId) {
+	std::unique_lock<std::mutex> lck{ mtx };
+	if (localUsers.erase(userId)) {
+		broadcastLocked(FrameType::Offline, userId);
+	}
+}
+
+void ClusterBus::forward(const std::vector<size_t>& userIds, EventPtr data, size_t exceptUserId) {
+	std::unique_lock<std::mutex> lck{ mtx };
+	// users of every node, allocated only if some user is remote
+	std::vector<std::vector<uint64_t>> targets;
+	for (auto userId : userIds) {
+		auto iter = routes.find(userId);
+		if ((userId == exceptUserId) || (iter == routes.end())) {
+			continue;
+		}
+		if (targets.empty()) {
+			targets.resize(nodes.size());
+		}
+		for (size_t node = 0; node < nodes.size(); ++node) {
+			if (iter->second & (uint64_t(1) << node)) {
+				targets[node].push_back(userId);
+			}
+		}
+	}
+	for (size_t node = 0; node < targets.size(); ++node) {
+		if (targets[node].empty()) {
+			continue;
+		}
+		auto& peer = *peers[node];
+		if (!peer.connected || (peer.outbox.size() >= MaxOutboxBytes)) {
+			++droppedEvents;
+			continue;
+		}
+		uint32_t usersCnt = (uint32_t)targets[node].size();
+		appendHeader(peer.outbox, FrameType::Event, sizeof(usersCnt) + usersCnt * sizeof(uint64_t) + data->size());
+		peer.outbox.append((const char*)&usersCnt, sizeof(usersCnt));
+		peer.outbox.append((const char*)targets[node].data(), usersCnt * sizeof(uint64_t));
+		peer.outbox.append(*data);
+		++forwardedEvents;
+		peer.cv.notify_one();
+	}
+}
+
+ClusterBus::Stats ClusterBus::stats() {
+	std::unique_lock<std::mutex> lck{ mtx };
+	Stats res;
+	for (const auto& peer : peers) {
+		res.connectedPeers += (peer && peer->connected) ? 1 : 0;
+	}
+	res.forwardedEvents = forwardedEvents;
+	res.droppedEvents = droppedEvents;
+	return res;
+}
+
+std::optional<std::pair<size_t, std::vector<std::string>>> ClusterBus::parseConfig(std::string_view config) {
+	auto at = config.find('@');
+	if (at == std::string_view::npos) {
+		return std::nullopt;
+	}
+	size_t id = 0;
+	auto [ptr, ec] = std::from_chars(config.data(), config.data() + at, id);
+	if ((ec != std::errc()) || (ptr != config.data() + at)) {
+		return std::nullopt;
+	}
+	std::vector<std::string> paths;
+	config.remove_prefix(at + 1);
+	while (!config.empty()) {
+		auto comma = config.find(',');
+		auto path = config.substr(0, comma);
+		if (path.empty()) {
+			return std::nullopt;
+		}
+		paths.emplace_back(path);
+		config.remove_prefix(comma == std::string_view::npos ? config.size() : comma + 1);
+	}
+	if ((id >= paths.size()) || (paths.size() > MaxNodes)) {
+		return std::nullopt;
+	}
+	return std::make_pair(id, std::move(paths));
+}
+
+void ClusterBus::broadcastLocked(FrameType type, size_t userId) {
+	for (auto& peer : peers) {
+		// disconnected peer gets snapshot of local users on connect
+		if (peer && peer->connected) {
+			appendHeader(peer->outbox, type, sizeof(uint64_t));
+			appendU64(peer->outbox, userId);
+			peer->cv.notify_one();
+		}
+	}
+}
+
+void ClusterBus::appendHeader(std::string& out, FrameType type, size_t payloadSize) {
+	uint32_t len = (uint32_t)(sizeof(uint8_t) + payloadSize);
+	out.append((const char*)&len, sizeof(len));
+	out.push_back((char)type);
+}
+
+void ClusterBus::appendU64(std::string& out, uint64_t value) {
+	out.append((const char*)&value, sizeof(value));
+}
+
+void ClusterBus::writerRun(Peer& peer) {
+	auto addr = makeAddress(peer.path);
+	std::string batch;
+	while (true) {
+		int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if ((fd >= 0) && (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)) {
+			::close(fd);
+			fd = -1;
+		}
+		{
+			std::unique_lock<std::mutex> lck{ mtx };
+			if (fd < 0) {
+				// peer is not started yet or restarting
+				if (peer.cv.wait_for(lck, std::chrono::milliseconds(ReconnectIntervalMs), [this]() { return stopped; })) {
+					return;
+				}
+				continue;
+			}
+			if (stopped) {
+				::close(fd);
+				return;
+			}
+			peer.fd = fd;
+			peer.connected = true;
+			peer.outbox.clear();
+			appendHeader(peer.outbox, FrameType::Hello, sizeof(uint64_t));
+			appendU64(peer.outbox, nodeId);
+			for (auto userId : localUsers) {
+				appendHeader(peer.outbox, FrameType::Online, sizeof(uint64_t));
+				appendU64(peer.outbox, userId);
+			}
+		}
+		alog::info("cluster node {} connected to node {}", nodeId, peer.nodeId);
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lck{ mtx };
+				peer.cv.wait(lck, [this, &peer]() { return stopped || !peer.outbox.empty(); });
+				if (stopped) {
+					break;
+				}
+				// everything queued during previous write goes out at once
+				batch.swap(peer.outbox);
+			}
+			if (!writeAll(fd, batch)) {
+				break;
+			}
+			batch.clear();
+		}
+		batch.clear();
+		{
+			std::unique_lock<std::mutex> lck{ mtx };
+			peer.fd = -1;
+			peer.connected = false;
+			peer.outbox.clear();
+		}
+		::close(fd);
+		alog::info("cluster node {} disconnected from node {}", nodeId, peer.nodeId);
+	}
+}
+
+void ClusterBus::listenerRun() {
+	while (true) {
+		int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			// listening socket is shut down
+			return;
+		}
+		// all nodes run as the same user
+		ucred cred{};
+		socklen_t credLen = sizeof(cred);
+		if ((::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) != 0) || (cred.uid != ::geteuid())) {
+			alog::error("rejected cluster connection of process {} of user {}", cred.pid, cred.uid);
+			::close(fd);
+			continue;
+		}
+		std::unique_lock<std::mutex> lck{ readersMtx };
+		reapReadersLocked();
+		size_t readerId = nextReaderId++;
+		readerFds.push_back(fd);
+		readers.emplace(readerId, std::thread([this, fd, readerId]() { readerRun(fd, readerId); }));
+	}
+}
+
+void ClusterBus::reapReadersLocked() {
+	for (auto readerId : finishedReaders) {
+		if (auto iter = readers.find(readerId); iter != readers.end()) {
+			iter->second.join();
+			readers.erase(iter);
+		}
+	}
+	finishedReaders.clear();
+}
+
+void ClusterBus::readerRun(int fd, size_t readerId) {
+	std::string buf;
+	size_t fromNode = NoNode;
+	bool valid = true;
+	while (valid) {
+		size_t oldSize = buf.size();
+		buf.resize(oldSize + ReadChunkSize);
+		auto got = ::recv(fd, buf.data() + oldSize, ReadChunkSize, 0);
+		if ((got < 0) && (errno == EINTR)) {
+			buf.resize(oldSize);
+			continue;
+		}
+		if (got <= 0) {
+			break;
+		}
+		buf.resize(oldSize + (size_t)got);
+		std::string_view rest(buf);
+		while (valid && (rest.size() >= FrameHeaderSize)) {
+			auto len = readInt<uint32_t>(rest);
+			if (len == 0) {
+				valid = false;
+				break;
+			}
+			if (rest.size() < sizeof(uint32_t) + len) {
+				break;
+			}
+			auto type = (FrameType)rest[sizeof(uint32_t)];
+			valid = handleFrame(fd, type, rest.substr(FrameHeaderSize, len - sizeof(uint8_t)), fromNode);
+			rest.remove_prefix(sizeof(uint32_t) + len);
+		}
+		buf.erase(0, buf.size() - rest.size());
+	}
+	if (!valid) {
+		alog::error("malformed frame from cluster node {}", fromNode);
+	}
+	if (fromNode != NoNode) {
+		std::unique_lock<std::mutex> lck{ mtx };
+		// reconnected node may have already announced its users over new connection
+		if (nodeReaderFds[fromNode] == fd) {
+			nodeReaderFds[fromNode] = -1;
+			dropNodeRoutesLocked(fromNode);
+		}
+	}
+	{
+		std::unique_lock<std::mutex> lck{ readersMtx };
+		std::erase(readerFds, fd);
+		finishedReaders.push_back(readerId);
+	}
+	::close(fd);
+}
+
+bool ClusterBus::handleFrame(int fd, FrameType type, std::string_view payload, size_t& fromNode) {
+	if (type == FrameType::Hello) {
+		if ((fromNode != NoNode) || (payload.size() != sizeof(uint64_t))) {
+			return false;
+		}
+		auto id = readInt<uint64_t>(payload);
+		if ((id >= nodes.size()) || (id == nodeId)) {
+			return false;
+		}
+		fromNode = (size_t)id;
+		std::unique_lock<std::mutex> lck{ mtx };
+		// node restarted before its previous connection was noticed closed, snapshot follows
+		dropNodeRoutesLocked(fromNode);
+		nodeReaderFds[fromNode] = fd;
+		return true;
+	}
+	// node should introduce itself first
+	if (fromNode == NoNode) {
+		return false;
+	}
+	if ((type == FrameType::Online) || (type == FrameType::Offline)) {
+		if (payload.size() != sizeof(uint64_t)) {
+			return false;
+		}
+		auto userId = readInt<uint64_t>(payload);
+		uint64_t bit = uint64_t(1) << fromNode;
+		std::unique_lock<std::mutex> lck{ mtx };
+		if (nodeReaderFds[fromNode] != fd) {
+			// superseded connection
+			return true;
+		}
+		if (type == FrameType::Online) {
+			routes[userId] |= bit;
+		}
+		else if (auto iter = routes.find(userId); iter != routes.end()) {
+			iter->second &= ~bit;
+			if (iter->second == 0) {
+				routes.erase(iter);
+			}
+		}
+		return true;
+	}
+	if (type == FrameType::Event) {
+		if (payload.size() < sizeof(uint32_t)) {
+			return false;
+		}
+		auto usersCnt = readInt<uint32_t>(payload);
+		payload.remove_prefix(sizeof(uint32_t));
+		if (payload.size() < usersCnt * sizeof(uint64_t)) {
+			return false;
+		}
+		std::vector<size_t> userIds(usersCnt);
+		for (auto& userId : userIds) {
+			userId = (size_t)readInt<uint64_t>(payload);
+			payload.remove_prefix(sizeof(uint64_t));
+		}
+		// delivered without lock, deliver() takes locks of local subscriptions
+		deliver(userIds, std::make_shared<const std::string>(payload));
+		return true;
+	}
+	return false;
+}
+
+void ClusterBus::dropNodeRoutesLocked(size_t node) {
+	uint64_t bit = uint64_t(1) << node;
+	for (auto iter = routes.begin(); iter != routes.end();) {
+		iter->second &= ~bit;
+		iter = (iter->second == 0) ? routes.erase(iter) : std::next(iter);
+	}
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+	Delivers events to users whose /events streams are held by other server processes.
+	Every node listens on its own Unix socket and keeps persistent connection to every other node.
+	Nodes announce users that got first or lost last local subscription, so every node knows
+	which nodes hold streams of user (routing table is a node bitmask per user).
+	Events are framed into per-peer outbox and written by peer writer thread,
+	everything queued while previous write was in progress goes out in one write.
+	Event for several users of one node (group chat) is sent once with list of users.
+	Outbox of disconnected peer is dropped: its streams are gone with it, and it gets
+	full snapshot of local users on reconnect.
+	Socket is accessible to owner only, and connections of processes of other users are rejected.
+*/
+class ClusterBus {
+public:
+	using EventPtr = std::shared_ptr<const std::string>;
+	// delivers event received from other node to local subscriptions
+	using DeliverFn = std::function<void(const std::vector<size_t>& userIds, EventPtr data)>;
+
+	// routing table is a bitmask
+	static constexpr size_t MaxNodes = 64;
+	// events for peer are dropped when its outbox is larger
+	static constexpr size_t MaxOutboxBytes = 4 * 1024 * 1024;
+	static constexpr size_t ReconnectIntervalMs = 1000;
+
+	struct Stats {
+		size_t connectedPeers = 0;
+		size_t forwardedEvents = 0;
+		size_t droppedEvents = 0;
+	};
+
+	// nodes[i] is Unix socket path of node i, nodeId is index of this node
+	ClusterBus(size_t nodeId, std::vector<std::string> nodes, DeliverFn deliver);
+	~ClusterBus();
+	ClusterBus(const ClusterBus&) = delete;
+	ClusterBus& operator=(const ClusterBus&) = delete;
+
+	// local user got first subscription or lost last one
+	void userOnline(size_t userId);
+	void userOffline(size_t userId);
+	// sends event to nodes holding streams of users
+	void forward(const std::vector<size_t>& userIds, EventPtr data, size_t exceptUserId = 0);
+	Stats stats();
+
+	// parses "<nodeId>@<path0>,<path1>,..."
+	static std::optional<std::pair<size_t, std::vector<std::string>>> parseConfig(std::string_view config);
+
+private:
+	enum class FrameType : uint8_t {
+		Hello,
+		Online,
+		Offline,
+		Event
+	};
+
+	struct Peer {
+		size_t nodeId = 0;
+		std::string path;
+		std::string outbox;
+		// connection socket, shut down on stop
+		int fd = -1;
+		bool connected = false;
+		std::condition_variable cv;
+		std::thread writer;
+	};
+
+	void broadcastLocked(FrameType type, size_t userId);
+	static void appendHeader(std::string& out, FrameType type, size_t payloadSize);
+	static void appendU64(std::string& out, uint64_t value);
+	void writerRun(Peer& peer);
+	void listenerRun();
+	void readerRun(int fd, size_t readerId);
+	// joins readers of closed connections, under readersMtx
+	void reapReadersLocked();
+	// returns false on malformed frame
+	bool handleFrame(int fd, FrameType type, std::string_view payload, size_t& fromNode);
+	void dropNodeRoutesLocked(size_t node);
+
+	const size_t nodeId;
+	const std::vector<std::string> nodes;
+	DeliverFn deliver;
+
+	std::mutex mtx;
+	bool stopped = false;
+	std::unordered_set<size_t> localUsers;
+	// key is userId, bit per node with streams of user
+	std::unordered_map<size_t, uint64_t> routes;
+	// accepted connection every node announces its users over, routes of node are dropped when it is closed
+	std::vector<int> nodeReaderFds;
+	std::vector<std::unique_ptr<Peer>> peers;
+	size_t forwardedEvents = 0;
+	size_t droppedEvents = 0;
+
+	int listenFd = -1;
+	std::thread listener;
+	// accepted connections, closed on stop
+	std::mutex readersMtx;
+	std::vector<int> readerFds;
+	// key is reader id, fds are reused, so they can't be keys
+	std::unordered_map<size_t, std::thread> readers;
+	// readers that are about to exit, joined on next accept
+	std::vector<size_t> finishedReaders;
+	size_t nextReaderId = 0;
+};
@@ -0,0 +1,309 @@
+#include "EventHub.hpp"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <format>
+#include "EventBroker.hpp"
+#include "profiling.hpp"
+
+EventHub::EventHub()
+	: epoch{ util::prof::tsMs() }, timers{ TimerTickMs, steadyMs() }, dispatcher{ [this]() { run(); } }
+{
+	;
+}
+
+EventHub::~EventHub() {
+	{
+		std::unique_lock<std::mutex> lck{ mtx };
+		stopped = true;
+	}
+	cv.notify_one();
+	dispatcher.join();
+}
+
+size_t EventHub::subscribe(size_t userId, HttpServer::CallbackMsgFn cb, std::string_view lastEventId) {
+	size_t id = 0;
+	bool notify = false;
+	{
+		std::unique_lock<std::mutex> lck{ mtx };
+		id = nextSubscriptionId++;
+		auto& userSubs = userSubscriptions[userId];
+		if (userSubs.size() == MaxSubscriptionsPerUser) {
+			// most likely the oldest stream belongs to a reconnected device
+			eraseLocked(userSubs.front());
+		}
+		userSubscriptions[userId].push_back(id);
+		if ((userSubscriptions[userId].size() == 1) && onPresence) {
+			onPresence(userId, true);
+		}
+		auto [eventsIter, inserted] = userEvents.try_emplace(userId);
+		auto& events = eventsIter->second;
+		if (inserted) {
+			// ring knows nothing about earlier events
+			events.coveredSeq = nextSeq - 1;
+		}
+		if (events.isOffline) {
+			offlineUsers.erase(events.offline);
+			events.isOffline = false;
+		}
+		// registered before dispatcher may see the subscription
+		EventBroker::get().registerProducerAndHandler(id, std::move(cb));
+		auto& sub = subscriptions[id];
+		sub.userId = userId;
+		sub.heartbeat = timers.arm(HeartbeatIntervalMs, id, steadyMs());
+		if (!lastEventId.empty()) {
+			replayLocked(events, lastEventId, sub.replay);
+		}
+		if (!sub.replay.empty()) {
+			sub.replaying = true;
+			sub.ready = true;
+			readySubscriptions.push_back(id);
+			notify = true;
+		}
+	}
+	if (notify) {
+		cv.notify_one();
+	}
+	return id;
+}
+
+void EventHub::unsubscribe(size_t subscriptionId) {
+	std::unique_lock<std::mutex> lck{ mtx };
+	eraseLocked(subscriptionId);
+}
+
+void EventHub::emit(size_t userId, std::string data) {
+	emit(userId, std::make_shared<const std::string>(std::move(data)));
+}
+
+void EventHub::emit(size_t userId, EventPtr data) {
+	bool notify = false;
+	{
+		std::unique_lock<std::mutex> lck{ mtx };
+		notify = emitLocked(userId, data);
+	}
+	if (notify) {
+		cv.notify_one();
+	}
+}
+
+void EventHub::emit(const std::vector<size_t>& userIds, EventPtr data, size_t exceptUserId) {
+	bool notify = false;
+	{
+		// one lock for whole group, every member gets the same buffer
+		std::unique_lock<std::mutex> lck{ mtx };
+		for (auto userId : userIds) {
+			if (userId != exceptUserId) {
+				notify |= emitLocked(userId, data);
+			}
+		}
+	}
+	if (notify) {
+		cv.notify_one();
+	}
+}
+
+bool EventHub::emitLocked(size_t userId, const EventPtr& data) {
+	Event event{ nextSeq++, data };
+	auto eventsIter = userEvents.find(userId);
+	if (eventsIter == userEvents.end()) {
+		// user had no stream for long, reconnecting one gets 'gap'
+		return false;
+	}
+	auto& events = eventsIter->second;
+	if (events.replay.size() == ReplayCapacity) {
+		events.coveredSeq = events.replay.front().seq;
+		events.replay.pop_front();
+	}
+	events.replay.push_back(event);
+	auto iter = userSubscriptions.find(userId);
+	if (iter == userSubscriptions.end()) {
+		return false;
+	}
+	bool notify = false;
+	for (auto id : iter->second) {
+		notify |= enqueueLocked(id, subscriptions[id], event);
+	}
+	return notify;
+}
+
+EventHub::Stats EventHub::stats() {
+	std::unique_lock<std::mutex> lck{ mtx };
+	Stats res;
+	res.subscriptions = subscriptions.size();
+	res.droppedEvents = droppedEvents;
+	for (const auto& [id, sub] : subscriptions) {
+		res.queuedEvents += sub.queue.size();
+	}
+	return res;
+}
+
+void EventHub::setPresenceHandler(PresenceFn fn) {
+	std::unique_lock<std::mutex> lck{ mtx };
+	onPresence = std::move(fn);
+}
+
+bool EventHub::enqueueLocked(size_t subscriptionId, Subscription& sub, Event event) {
+	if (sub.queue.size() == QueueCapacity) {
+		sub.queue.pop_front();
+		++droppedEvents;
+	}
+	sub.queue.push_back(std::move(event));
+	// stream is not idle anymore
+	timers.cancel(sub.heartbeat);
+	sub.heartbeat = timers.arm(HeartbeatIntervalMs, subscriptionId, steadyMs());
+	// replaying subscription is scheduled already and gets its queue after replay
+	if (sub.ready) {
+		return false;
+	}
+	sub.ready = true;
+	readySubscriptions.push_back(subscriptionId);
+	return true;
+}
+
+void EventHub::replayLocked(const UserEvents& events, std::string_view lastEventId, std::string& out) const {
+	size_t lastSeq = nextSeq - 1;
+	// Last-Event-ID is "<epoch>-<seq>"
+	size_t idEpoch = 0;
+	size_t seq = 0;
+	auto [ptr, ec] = std::from_chars(lastEventId.data(), lastEventId.data() + lastEventId.size(), idEpoch);
+	bool valid = (ec == std::errc()) && (ptr != lastEventId.data() + lastEventId.size()) && (*ptr == '-');
+	if (valid) {
+		auto [seqPtr, seqEc] = std::from_chars(ptr + 1, lastEventId.data() + lastEventId.size(), seq);
+		valid = (seqEc == std::errc()) && (seqPtr == lastEventId.data() + lastEventId.size());
+	}
+	// ids of previous run, ids from future, or events already pushed out of the ring
+	if (!valid || (idEpoch != epoch) || (seq > lastSeq) || (seq < events.coveredSeq)) {
+		out += encode(Event{ lastSeq, nullptr, Event::Kind::Gap });
+		return;
+	}
+	for (const auto& event : events.replay) {
+		if (event.seq > seq) {
+			out += encode(event);
+		}
+	}
+}
+
+void EventHub::maintainLocked(size_t nowMs) {
+	while (!offlineUsers.empty()) {
+		auto iter = userEvents.find(offlineUsers.front());
+		if ((offlineUsers.size() <= MaxOfflineReplayUsers) && (nowMs - iter->second.offlineSinceMs < ReplayRetentionMs)) {
+			break;
+		}
+		userEvents.erase(iter);
+		offlineUsers.pop_front();
+	}
+}
+
+void EventHub::eraseLocked(size_t subscriptionId) {
+	auto iter = subscriptions.find(subscriptionId);
+	if (iter == subscriptions.end()) {
+		return;
+	}
+	if (auto userIter = userSubscriptions.find(iter->second.userId); userIter != userSubscriptions.end()) {
+		std::erase(userIter->second, subscriptionId);
+		if (userIter->second.empty()) {
+			userSubscriptions.erase(userIter);
+			// ring is kept for a while for reconnecting device
+			if (auto eventsIter = userEvents.find(iter->second.userId); eventsIter != userEvents.end()) {
+				eventsIter->second.offline = offlineUsers.insert(offlineUsers.end(), iter->second.userId);
+				eventsIter->second.isOffline = true;
+				eventsIter->second.offlineSinceMs = steadyMs();
+			}
+			if (onPresence) {
+				onPresence(iter->second.userId, false);
+			}
+		}
+	}
+	timers.cancel(iter->second.heartbeat);
+	// id may stay in readySubscriptions, dispatcher skips unknown ids
+	subscriptions.erase(iter);
+}
+
+std::string EventHub::encode(const Event& event) const {
+	if (event.kind == Event::Kind::Heartbeat) {
+		return ": heartbeat\r\n\r\n";
+	}
+	if (event.kind == Event::Kind::Gap) {
+		return std::format("id: {}-{}\r\nevent: gap\r\ndata: {{}}\r\n\r\n", epoch, event.seq);
+	}
+	return std::format("id: {}-{}\r\ndata: {}\r\n\r\n", epoch, event.seq, *event.data);
+}
+
+size_t EventHub::steadyMs() {
+	return (size_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void EventHub::run() {
+	struct Pending {
+		size_t id = 0;
+		std::string replay;
+		std::deque<Event> events;
+	};
+	std::vector<size_t> ready;
+	std::vector<Pending> batch;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lck{ mtx };
+			cv.wait_for(lck, std::chrono::milliseconds(TimerTickMs), [this]() { return stopped || !readySubscriptions.empty(); });
+			if (stopped) {
+				return;
+			}
+			size_t nowMs = steadyMs();
+			timers.advance(nowMs, [this](size_t id) {
+				if (auto iter = subscriptions.find(id); iter != subscriptions.end()) {
+					// re-arms heartbeat timer
+					enqueueLocked(id, iter->second, Event{ 0, nullptr, Event::Kind::Heartbeat });
+				}
+				});
+			maintainLocked(nowMs);
+			ready.swap(readySubscriptions);
+			for (auto id : ready) {
+				auto iter = subscriptions.find(id);
+				if (iter == subscriptions.end()) {
+					continue;
+				}
+				auto& sub = iter->second;
+				if (sub.replaying) {
+					// live events wait in queue, subscription stays 'ready' until replay is handed out
+					batch.push_back(Pending{ id, std::move(sub.replay), {} });
+					sub.replay.clear();
+					continue;
+				}
+				sub.ready = false;
+				batch.push_back(Pending{ id, {}, std::move(sub.queue) });
+				sub.queue.clear();
+			}
+			ready.clear();
+		}
+		// writing to sockets without lock, so emit() is never blocked by slow reader
+		bool replayed = false;
+		for (auto& pending : batch) {
+			if (!pending.replay.empty()) {
+				EventBroker::get().emitEvent(pending.id, std::move(pending.replay));
+				replayed = true;
+			}
+			for (const auto& event : pending.events) {
+				EventBroker::get().emitEvent(pending.id, encode(event));
+			}
+		}
+		if (replayed) {
+			std::unique_lock<std::mutex> lck{ mtx };
+			for (auto& pending : batch) {
+				auto iter = subscriptions.find(pending.id);
+				if ((iter == subscriptions.end()) || !iter->second.replaying) {
+					continue;
+				}
+				// queued live events follow the replay
+				iter->second.replaying = false;
+				if (!iter->second.queue.empty()) {
+					readySubscriptions.push_back(pending.id);
+				}
+				else {
+					iter->second.ready = false;
+				}
+			}
+		}
+		batch.clear();
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "HttpServer.hpp"
+#include "TimerWheel.hpp"
+
+/*
+	Fans events out to every subscription (device) of a user.
+	Every subscription is registered in EventBroker under its own id and has its own bounded queue.
+	emit() only enqueues shared event buffer and never waits for sockets,
+	events are handed to EventBroker by dispatcher thread.
+	EventBroker reports neither refused writes nor closed connections, so there is no backpressure
+	from sockets and a closed stream stays subscribed until it is evicted by a newer stream of the same user
+	(MaxSubscriptionsPerUser) or unsubscribe() is called.
+	Every event gets sequence id ("<epoch>-<seq>" in SSE 'id' field, seq grows hub-wide) and stays in replay ring
+	of user, so reconnecting stream with Last-Event-ID receives only missed events,
+	or 'gap' event if they are not in the ring anymore. Missed events are the first thing dispatcher sends to new stream,
+	live events are queued behind them until they are handed to EventBroker.
+	Rings of users without streams are kept for ReplayRetentionMs, at most for MaxOfflineReplayUsers users.
+	Streams idle for HeartbeatIntervalMs get SSE comment, so proxies don't drop them,
+	heartbeat timers live in timing wheel and are re-armed on every event.
+*/
+class EventHub {
+public:
+	using EventPtr = std::shared_ptr<const std::string>;
+	// called under hub lock when user gets first subscription or loses last one
+	using PresenceFn = std::function<void(size_t userId, bool online)>;
+
+	// events queued for one subscription, oldest are dropped on overflow
+	static constexpr size_t QueueCapacity = 256;
+	// latest events kept per user for Last-Event-ID replay
+	static constexpr size_t ReplayCapacity = 256;
+	// idle time after which heartbeat comment is sent to stream
+	static constexpr size_t HeartbeatIntervalMs = 15000;
+	static constexpr size_t TimerTickMs = 500;
+	// devices per user, oldest subscription is evicted when new one exceeds limit
+	static constexpr size_t MaxSubscriptionsPerUser = 8;
+	// how long replay ring outlives the last stream of user
+	static constexpr size_t ReplayRetentionMs = 5 * 60 * 1000;
+	static constexpr size_t MaxOfflineReplayUsers = 65536;
+
+	struct Stats {
+		size_t subscriptions = 0;
+		size_t queuedEvents = 0;
+		size_t droppedEvents = 0;
+	};
+
+	EventHub();
+	~EventHub();
+	EventHub(const EventHub&) = delete;
+	EventHub& operator=(const EventHub&) = delete;
+
+	// returns subscription id, cb is message callback of stream connection,
+	// lastEventId is value of Last-Event-ID header of reconnected stream
+	size_t subscribe(size_t userId, HttpServer::CallbackMsgFn cb, std::string_view lastEventId);
+	void unsubscribe(size_t subscriptionId);
+	// data is SSE 'data' field value
+	void emit(size_t userId, std::string data);
+	void emit(size_t userId, EventPtr data);
+	// emits the same event to every user, e.g. members of group chat
+	void emit(const std::vector<size_t>& userIds, EventPtr data, size_t exceptUserId = 0);
+	Stats stats();
+	// should be set before first subscription; after it returns previous handler is not running and won't be called
+	void setPresenceHandler(PresenceFn fn);
+
+private:
+	struct Event {
+		enum class Kind {
+			Data,
+			// client missed more events than replay ring holds and should refetch its state
+			Gap,
+			Heartbeat
+		};
+		size_t seq = 0;
+		EventPtr data;
+		Kind kind = Kind::Data;
+	};
+
+	struct Subscription {
+		size_t userId = 0;
+		std::deque<Event> queue;
+		bool ready = false;
+		// encoded missed events, queue is not dispatched until they are sent
+		std::string replay;
+		bool replaying = false;
+		TimerWheel::Handle heartbeat = 0;
+	};
+
+	struct UserEvents {
+		// every event of user with greater seq is in replay
+		size_t coveredSeq = 0;
+		std::deque<Event> replay;
+		// position in offlineUsers while user has no streams
+		std::list<size_t>::iterator offline;
+		bool isOffline = false;
+		size_t offlineSinceMs = 0;
+	};
+
+	// returns true if dispatcher should be woken up
+	bool emitLocked(size_t userId, const EventPtr& data);
+	// returns true if subscription got scheduled for dispatch
+	bool enqueueLocked(size_t subscriptionId, Subscription& sub, Event event);
+	void replayLocked(const UserEvents& events, std::string_view lastEventId, std::string& out) const;
+	// drops replay rings of users offline for too long
+	void maintainLocked(size_t nowMs);
+	void eraseLocked(size_t subscriptionId);
+	std::string encode(const Event& event) const;
+	static size_t steadyMs();
+	void run();
+
+	// distinguishes sequence ids of this process from ids of previous runs
+	const size_t epoch;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopped = false;
+	// ids are keys in EventBroker, so they never repeat
+	size_t nextSubscriptionId = 1;
+	size_t nextSeq = 1;
+	size_t droppedEvents = 0;
+	std::unordered_map<size_t, Subscription> subscriptions;
+	// key is userId, subscription ids from oldest to newest
+	std::unordered_map<size_t, std::vector<size_t>> userSubscriptions;
+	// key is userId, only users with streams or recently closed streams
+	std::unordered_map<size_t, UserEvents> userEvents;
+	// users whose last stream was closed, oldest first
+	std::list<size_t> offlineUsers;
+	// heartbeat timers, key is subscription id
+	TimerWheel timers;
+	// subscriptions with non empty queue
+	std::vector<size_t> readySubscriptions;
+	PresenceFn onPresence;
+	std::thread dispatcher;
+};
@@ -1,10 +1,15 @@
 #include "MessengerDb.hpp"
 #include <format>
-#include <ProjLogger.hpp>
+#include "AsyncLog.hpp"
+#include "Metrics.hpp"
+#include "Tracing.hpp"
 
 using namespace db;
 using namespace util::web::json;
 
+// records query time of enclosing MessengerDb method to metrics and request trace
+#define DbTimer(op) static const size_t dbMetricId = Metrics::get().histogram("messenger_db_query_duration_seconds", "MySQL query time of MessengerDb calls", "op=\"" op "\""); ScopedTimer dbTimer{ dbMetricId }; TraceSpan dbSpan{ "db." op }
+
 User::User(size_t id, std::string username, const std::string& pwdHash, const std::string& authToken)
     : id{id}, username{username}, pwdHash{pwdHash}, authToken{authToken}
 {
@@ -94,15 +99,19 @@ util::web::json::ObjNode TxtMessage::toObjNode() const {
 }
 
 MessengerDb::MessengerDb(const std::string& url, const std::string& username, const std::string& pwd, const std::string& schema)
-	: db{new DbMysql()}
+	: db{new DbMysql()}, txDb{new DbMysql()}
 {
     db->connect(url, username, pwd);
     db->setSchema(schema);
+    txDb->connect(url, username, pwd);
+    txDb->setSchema(schema);
+    migrate();
 	//db->connect("tcp://127.0.0.1:3306", "onyazuka", "5051");
 	//db->setSchema("messenger");
 }
 
 std::pair<MessengerDb::Error, std::optional<size_t>> MessengerDb::registerUser(const std::string& username, const std::string& pwdHash, const std::string& authToken) {
+    DbTimer("registerUser");
     try {
         int sz = db->modify(std::format("insert into User values (NULL,'{}','{}','{}')", username, pwdHash, authToken));
         if (sz) {
@@ -114,34 +123,37 @@ std::pair<MessengerDb::Error, std::optional<size_t>> MessengerDb::registerUser(c
         }
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, std::nullopt };
     }
 }
 
 std::pair<MessengerDb::Error, bool> MessengerDb::loginUser(size_t id, const std::string& authToken) {
+    DbTimer("loginUser");
     try {
         db->query(std::format("select count(*) from User where id={} and authToken='{}'", id, authToken));
         return { Error::Ok, db->result<uint64_t>() };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, false };
     }
 }
 
 std::pair<MessengerDb::Error, std::vector<User>> MessengerDb::getUsers() {
+    DbTimer("getUsers");
     try {
         db->query("select * from User");
         return { Error::Ok, vecTuples2vecStructs<User>(db->result<size_t, std::string, std::string, std::string>({1,2,3,4})) };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, {} };
     }
 }
 
 std::pair<MessengerDb::Error, std::optional<size_t>> MessengerDb::addContactToAddressBook(size_t whoId, size_t withId) {
+    DbTimer("addContactToAddressBook");
     if (whoId == withId) {
         return { Error::InvalidQuery, std::nullopt };
     }
@@ -156,58 +168,63 @@ std::pair<MessengerDb::Error, std::optional<size_t>> MessengerDb::addContactToAd
         }
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, std::nullopt };
     }
 }
 
 std::pair<MessengerDb::Error, std::vector<AddressBook>> MessengerDb::getAddressBooks() {
+    DbTimer("getAddressBooks");
     try {
         db->query("select * from AddressBook");
         return { Error::Ok, vecTuples2vecStructs<AddressBook>(db->result<size_t, size_t, size_t>({1,2,3})) };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, {} };
     }
 }
 
 std::pair<MessengerDb::Error, std::vector<AddressBook>> MessengerDb::getContactsFromAddressBook(size_t forWhoId) {
+    DbTimer("getContactsFromAddressBook");
     try {
         db->query(std::format("select * from AddressBook where whoId={}", forWhoId));
         return { Error::Ok, vecTuples2vecStructs<AddressBook>(db->result<size_t,size_t,size_t>({1,2,3})) };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, {} };
     }
 }
 
 std::pair<MessengerDb::Error, bool> MessengerDb::deleteContactFromAddressBook(size_t whoId, size_t withId) {
+    DbTimer("deleteContactFromAddressBook");
     try {
         int sz = db->modify(std::format("delete from AddressBook where whoId={} and withId={}", whoId, withId));
         if (sz) return { Error::Ok, true };
         else return { Error::NotExists, false };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, false };
     }
 }
 
 std::pair<MessengerDb::Error, bool> MessengerDb::deleteContactFromAddressBook(size_t id) {
+    DbTimer("deleteContactFromAddressBookById");
     try {
         int sz = db->modify(std::format("delete from AddressBook where id={}", id));
         if (sz) return { Error::Ok, true };
         else return { Error::NotExists, false };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, false };
     }
 }
 
 std::pair<MessengerDb::Error, std::optional<size_t>> MessengerDb::addChat(size_t whoId, size_t withId) {
+    DbTimer("addChat");
     if (whoId == withId) {
         return { Error::InvalidQuery, std::nullopt };
     }
@@ -231,38 +248,119 @@ std::pair<MessengerDb::Error, std::optional<size_t>> MessengerDb::addChat(size_t
         }
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, std::nullopt };
     }
 }
 
 std::pair<MessengerDb::Error, std::vector<Chat>> MessengerDb::getChatsForId(size_t forWhoId) {
+    DbTimer("getChatsForId");
     try {
-        db->query(std::format("select * from Chat where whoId={}", forWhoId));
+        db->query(std::format("select id, whoId, ifnull(withId, 0) from Chat where whoId={}", forWhoId));
         std::vector<std::tuple<size_t, size_t, size_t>> res1 = db->result<size_t, size_t, size_t>({ 1,2,3 });
         db->query(std::format("select * from Chat where withId={}", forWhoId));
         std::vector<std::tuple<size_t, size_t, size_t>> res2 = db->result<size_t, size_t, size_t>({ 1,2,3 });
         res1.insert(res1.end(), res2.begin(), res2.end());
+        // group chats where user is a member, but not creator
+        db->query(std::format("select Chat.id, Chat.whoId, 0 from Chat join ChatMember on Chat.id=ChatMember.chatId where ChatMember.userId={} and Chat.whoId<>{}", forWhoId, forWhoId));
+        std::vector<std::tuple<size_t, size_t, size_t>> res3 = db->result<size_t, size_t, size_t>({ 1,2,3 });
+        res1.insert(res1.end(), res3.begin(), res3.end());
         return { Error::Ok, vecTuples2vecStructs<Chat>(std::move(res1)) };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, {} };
     }
 }
 
 std::pair<MessengerDb::Error, std::vector<Chat>> MessengerDb::getChats() {
+    DbTimer("getChats");
     try {
-        db->query("select * from Chat");
+        db->query("select id, whoId, ifnull(withId, 0) from Chat");
         return { Error::Ok, vecTuples2vecStructs<Chat>(db->result<size_t,size_t,size_t>({1,2,3})) };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, {} };
+    }
+}
+
+std::pair<MessengerDb::Error, std::optional<size_t>> MessengerDb::addGroupChat(size_t creatorId) {
+    DbTimer("addGroupChat");
+    std::unique_lock<std::mutex> lck{ txMtx };
+    try {
+        // group chat without its creator as member would be invisible to everyone
+        txDb->modify("START TRANSACTION");
+        int sz = txDb->modify(std::format("insert into Chat values (NULL, {}, NULL)", creatorId));
+        std::optional<size_t> optId;
+        if (sz) {
+            txDb->query("select LAST_INSERT_ID()");
+            optId = txDb->result<uint64_t>();
+        }
+        if (!optId.has_value() || !txDb->modify(std::format("insert into ChatMember values ({}, {})", optId.value(), creatorId))) {
+            txDb->modify("ROLLBACK");
+            return { Error::InvalidQuery, std::nullopt };
+        }
+        txDb->modify("COMMIT");
+        return { Error::Ok, optId };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
+        try {
+            txDb->modify("ROLLBACK");
+        }
+        catch (std::exception& rollbackEx) {
+            alog::error("{}", rollbackEx.what());
+        }
+        return { Error::InvalidQuery, std::nullopt };
+    }
+}
+
+std::pair<MessengerDb::Error, bool> MessengerDb::addChatMember(size_t chatId, size_t userId) {
+    DbTimer("addChatMember");
+    try {
+        // only group chats have members
+        int sz = db->modify(std::format("insert ignore into ChatMember select {}, {} where (select COUNT(*) from Chat where id={} and withId is NULL) > 0", chatId, userId, chatId));
+        if (sz) return { Error::Ok, true };
+        else return { Error::NotExists, false };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, false };
+    }
+}
+
+std::pair<MessengerDb::Error, bool> MessengerDb::deleteChatMember(size_t chatId, size_t userId) {
+    DbTimer("deleteChatMember");
+    try {
+        int sz = db->modify(std::format("delete from ChatMember where chatId={} and userId={}", chatId, userId));
+        if (sz) return { Error::Ok, true };
+        else return { Error::NotExists, false };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, false };
+    }
+}
+
+std::pair<MessengerDb::Error, std::vector<std::pair<size_t, size_t>>> MessengerDb::getChatMembers() {
+    DbTimer("getChatMembers");
+    try {
+        db->query("select chatId, userId from ChatMember");
+        std::vector<std::pair<size_t, size_t>> res;
+        for (auto [chatId, userId] : db->result<size_t, size_t>({ 1,2 })) {
+            res.emplace_back(chatId, userId);
+        }
+        return { Error::Ok, std::move(res) };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, {} };
     }
 }
 
 std::pair<MessengerDb::Error, bool> MessengerDb::deleteChat(size_t whoId, size_t withId) {
+    DbTimer("deleteChat");
     if (withId < whoId) {
         std::swap(whoId, withId);
     }
@@ -272,28 +370,30 @@ std::pair<MessengerDb::Error, bool> MessengerDb::deleteChat(size_t whoId, size_t
         else return { Error::NotExists, false };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, false };
     }
 }
 
 std::pair<MessengerDb::Error, bool> MessengerDb::deleteChat(size_t id) {
+    DbTimer("deleteChatById");
     try {
         int sz = db->modify(std::format("delete from Chat where id={}", id));
         if (sz) return { Error::Ok, true };
         else return { Error::NotExists, false };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, false };
     }
 }
 
 std::pair<MessengerDb::Error, std::optional<size_t>> MessengerDb::addTxtMessage(size_t chatId, size_t whoId, const std::string& text, size_t timestamp) {
+    DbTimer("addTxtMessage");
     try {
-        // inserting only if whoId matches to chatId whoId or withId
+        // inserting only if whoId matches to chatId whoId or withId, or is a member of group chat
         //std::string query = std::format("insert into TxtMessage select NULL, {}, {}, '{}', NOW() where (select COUNT(*) from Chat where chatId={} and whoId={}) > 0 or (select COUNT(*) from Chat where chatId={} and withId={}) > 0", chatId, whoId, SEC(text), chatId, whoId, chatId, whoId);
-        int sz = db->modify(std::format("insert into TxtMessage select NULL, {}, {}, '{}', {} where (select COUNT(*) from Chat where id={} and whoId={}) > 0 or (select COUNT(*) from Chat where id={} and withId={}) > 0", chatId, whoId, SEC(text), timestamp, chatId, whoId, chatId, whoId));
+        int sz = db->modify(std::format("insert into TxtMessage select NULL, {}, {}, '{}', {} where (select COUNT(*) from Chat where id={} and whoId={}) > 0 or (select COUNT(*) from Chat where id={} and withId={}) > 0 or (select COUNT(*) from ChatMember where chatId={} and userId={}) > 0", chatId, whoId, SEC(text), timestamp, chatId, whoId, chatId, whoId, chatId, whoId));
         if (sz) {
             db->query("select LAST_INSERT_ID()");
             return { Error::Ok, db->result<uint64_t>() };
@@ -303,30 +403,174 @@ std::pair<MessengerDb::Error, std::optional<size_t>> MessengerDb::addTxtMessage(
         }
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, std::nullopt };
     }
 }
 
 std::pair<MessengerDb::Error, bool> MessengerDb::deleteTxtMessage(size_t id) {
+    DbTimer("deleteTxtMessage");
     try {
         int sz = db->modify(std::format("delete from TxtMessage where id={}", id));
         if (sz) return { Error::Ok, true };
         else return { Error::NotExists, false };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, false };
     }
 }
 
 std::pair<MessengerDb::Error, std::vector<TxtMessage>> MessengerDb::getTxtMessagesForChat(size_t chatId) {
+    DbTimer("getTxtMessagesForChat");
     try {
         db->query(std::format("select * from TxtMessage where chatId={}", chatId));
         return { Error::Ok, vecTuples2vecStructs<TxtMessage>(db->result<size_t, size_t, size_t, std::string, size_t>({ 1,2,3,4,5 })) };
     }
     catch (std::exception& ex) {
-        Log.error(ex.what());
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, {} };
+    }
+}
+
+std::pair<MessengerDb::Error, std::vector<TxtMessage>> MessengerDb::getLastTxtMessagesForChats(std::span<const size_t> chatIds, size_t count) {
+    DbTimer("getLastTxtMessagesForChats");
+    if (chatIds.empty()) {
+        return { Error::Ok, {} };
+    }
+    try {
+        std::string sChatIds;
+        for (auto chatId : chatIds) {
+            if (!sChatIds.empty()) {
+                sChatIds += ',';
+            }
+            sChatIds += std::to_string(chatId);
+        }
+        db->query(std::format("select id, chatId, whoId, message, ts from (select *, row_number() over (partition by chatId order by id desc) as rn from TxtMessage where chatId in ({})) as t where rn <= {}", sChatIds, count));
+        return { Error::Ok, vecTuples2vecStructs<TxtMessage>(db->result<size_t, size_t, size_t, std::string, size_t>({ 1,2,3,4,5 })) };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, {} };
+    }
+}
+
+std::pair<MessengerDb::Error, std::vector<TxtMessage>> MessengerDb::getTxtMessagesByIds(std::span<const size_t> ids) {
+    DbTimer("getTxtMessagesByIds");
+    if (ids.empty()) {
+        return { Error::Ok, {} };
+    }
+    try {
+        std::string sIds;
+        for (auto id : ids) {
+            if (!sIds.empty()) {
+                sIds += ',';
+            }
+            sIds += std::to_string(id);
+        }
+        db->query(std::format("select * from TxtMessage where id in ({}) order by id desc", sIds));
+        return { Error::Ok, vecTuples2vecStructs<TxtMessage>(db->result<size_t, size_t, size_t, std::string, size_t>({ 1,2,3,4,5 })) };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, {} };
+    }
+}
+
+std::pair<MessengerDb::Error, std::vector<TxtMessage>> MessengerDb::getTxtMessagesAfterId(size_t afterId, size_t count) {
+    DbTimer("getTxtMessagesAfterId");
+    try {
+        db->query(std::format("select * from TxtMessage where id>{} order by id limit {}", afterId, count));
+        return { Error::Ok, vecTuples2vecStructs<TxtMessage>(db->result<size_t, size_t, size_t, std::string, size_t>({ 1,2,3,4,5 })) };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, {} };
+    }
+}
+
+std::pair<MessengerDb::Error, bool> MessengerDb::addAttachments(size_t messageId, const std::vector<std::string>& hashes) {
+    DbTimer("addAttachments");
+    if (hashes.empty()) {
+        return { Error::Ok, true };
+    }
+    try {
+        std::string values;
+        for (const auto& hash : hashes) {
+            if (!values.empty()) {
+                values += ',';
+            }
+            values += std::format("({},'{}')", messageId, SEC(hash));
+        }
+        db->modify(std::format("insert ignore into Attachment values {}", values));
+        return { Error::Ok, true };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, false };
+    }
+}
+
+std::pair<MessengerDb::Error, std::vector<std::string>> MessengerDb::getReferencedBlobs(const std::vector<std::string>& hashes) {
+    DbTimer("getReferencedBlobs");
+    if (hashes.empty()) {
+        return { Error::Ok, {} };
+    }
+    try {
+        std::string values;
+        for (const auto& hash : hashes) {
+            if (!values.empty()) {
+                values += ',';
+            }
+            values += std::format("'{}'", SEC(hash));
+        }
+        db->query(std::format("select distinct hash from Attachment where hash in ({})", values));
+        std::vector<std::string> res;
+        for (auto& [hash] : db->result<std::string>({ 1 })) {
+            res.push_back(std::move(hash));
+        }
+        return { Error::Ok, std::move(res) };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, {} };
+    }
+}
+
+std::pair<MessengerDb::Error, bool> MessengerDb::addBlobOwner(size_t userId, const std::string& hash) {
+    DbTimer("addBlobOwner");
+    try {
+        db->modify(std::format("insert ignore into BlobOwner values ({},'{}')", userId, SEC(hash)));
+        return { Error::Ok, true };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
+        return { Error::InvalidQuery, false };
+    }
+}
+
+std::pair<MessengerDb::Error, std::vector<std::string>> MessengerDb::getOwnedBlobs(size_t userId, const std::vector<std::string>& hashes) {
+    DbTimer("getOwnedBlobs");
+    if (hashes.empty()) {
+        return { Error::Ok, {} };
+    }
+    try {
+        std::string values;
+        for (const auto& hash : hashes) {
+            if (!values.empty()) {
+                values += ',';
+            }
+            values += std::format("'{}'", SEC(hash));
+        }
+        db->query(std::format("select hash from BlobOwner where userId={} and hash in ({})", userId, values));
+        std::vector<std::string> res;
+        for (auto& [hash] : db->result<std::string>({ 1 })) {
+            res.push_back(std::move(hash));
+        }
+        return { Error::Ok, std::move(res) };
+    }
+    catch (std::exception& ex) {
+        alog::error("{}", ex.what());
         return { Error::InvalidQuery, {} };
     }
 }
@@ -336,10 +580,26 @@ void MessengerDb::createTables() {
     db->modify("CREATE TABLE AddressBook (id bigint unsigned NOT NULL AUTO_INCREMENT,whoId bigint unsigned NOT NULL,withId bigint unsigned NOT NULL,PRIMARY KEY(id),UNIQUE KEY unique_entry (whoId,withId),KEY withId (withId),CONSTRAINT AddressBook_ibfk_1 FOREIGN KEY(whoId) REFERENCES User (id) ON DELETE CASCADE ON UPDATE CASCADE,CONSTRAINT AddressBook_ibfk_2 FOREIGN KEY(withId) REFERENCES User (id) ON DELETE CASCADE ON UPDATE CASCADE)");
     db->modify("CREATE TABLE Chat (id bigint unsigned NOT NULL AUTO_INCREMENT,whoId bigint unsigned NOT NULL,withId bigint unsigned NOT NULL,PRIMARY KEY(id),UNIQUE KEY unique_entry (whoId,withId),KEY withId (withId),CONSTRAINT Chat_ibfk_1 FOREIGN KEY(whoId) REFERENCES User (id) ON DELETE CASCADE ON UPDATE CASCADE,CONSTRAINT Chat_ibfk_2 FOREIGN KEY(withId) REFERENCES User (id) ON DELETE CASCADE ON UPDATE CASCADE)");
     db->modify("CREATE TABLE TxtMessage (id bigint unsigned NOT NULL AUTO_INCREMENT,chatId bigint unsigned NOT NULL,whoId bigint unsigned NOT NULL,message text NOT NULL,ts timestamp NOT NULL,PRIMARY KEY(id),KEY chatId (chatId),KEY whoId (whoId),CONSTRAINT TxtMessage_ibfk_1 FOREIGN KEY(chatId) REFERENCES Chat (id) ON DELETE CASCADE ON UPDATE CASCADE,CONSTRAINT TxtMessage_ibfk_2 FOREIGN KEY(whoId) REFERENCES User (id) ON DELETE CASCADE ON UPDATE CASCADE)");
+    migrate();
+}
+
+void MessengerDb::migrate() {
+    // every step may be run again on already migrated schema
+    // group chats have no second party; table is rebuilt by ALTER, so it is done only once
+    db->query("select IS_NULLABLE from information_schema.COLUMNS where TABLE_SCHEMA=DATABASE() and TABLE_NAME='Chat' and COLUMN_NAME='withId'");
+    if (db->result<std::string>() != "YES") {
+        db->modify("ALTER TABLE Chat MODIFY withId bigint unsigned DEFAULT NULL");
+    }
+    db->modify("CREATE TABLE IF NOT EXISTS ChatMember (chatId bigint unsigned NOT NULL,userId bigint unsigned NOT NULL,PRIMARY KEY(chatId,userId),KEY userId (userId),CONSTRAINT ChatMember_ibfk_1 FOREIGN KEY(chatId) REFERENCES Chat (id) ON DELETE CASCADE ON UPDATE CASCADE,CONSTRAINT ChatMember_ibfk_2 FOREIGN KEY(userId) REFERENCES User (id) ON DELETE CASCADE ON UPDATE CASCADE)");
+    db->modify("CREATE TABLE IF NOT EXISTS Attachment (messageId bigint unsigned NOT NULL,hash char(64) NOT NULL,PRIMARY KEY(messageId,hash),KEY hash (hash),CONSTRAINT Attachment_ibfk_1 FOREIGN KEY(messageId) REFERENCES TxtMessage (id) ON DELETE CASCADE ON UPDATE CASCADE)");
+    db->modify("CREATE TABLE IF NOT EXISTS BlobOwner (userId bigint unsigned NOT NULL,hash char(64) NOT NULL,PRIMARY KEY(userId,hash),CONSTRAINT BlobOwner_ibfk_1 FOREIGN KEY(userId) REFERENCES User (id) ON DELETE CASCADE ON UPDATE CASCADE)");
 }
 
 void MessengerDb::deleteTables() {
+    db->modify("drop table BlobOwner");
+    db->modify("drop table Attachment");
     db->modify("drop table TxtMessage");
+    db->modify("drop table ChatMember");
     db->modify("drop table Chat");
     db->modify("drop table AddressBook");
     db->modify("drop table User");
@@ -349,5 +609,8 @@ void MessengerDb::cleanDb() {
 	db->modify("delete from User");
 	db->modify("delete from AddressBook");
 	db->modify("delete from Chat");
+	db->modify("delete from ChatMember");
 	db->modify("delete from TxtMessage");
+	db->modify("delete from Attachment");
+	db->modify("delete from BlobOwner");
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 #include "DbMysql.hpp"
+#include <mutex>
 #include <optional>
+#include <span>
 #include <cstdint>
 #include "Json.hpp"
 #include "Utils_String.hpp"
@@ -46,7 +48,9 @@ namespace db {
 		Chat(size_t id);
 		size_t id = 0;
 		size_t whoId = 0;
+		// 0 for group chat, its members are in ChatMember
 		size_t withId = 0;
+		inline bool isGroup() const { return withId == 0; }
 		util::web::json::ObjNode toObjNode() const;
 		inline bool operator==(const Chat& other) const { return id == other.id; }
 	};
@@ -98,6 +102,14 @@ namespace db {
 		std::pair<Error, std::vector<Chat>> getChatsForId(size_t forWhoId);
 		// returns all chats
 		std::pair<Error, std::vector<Chat>> getChats();
+		// returns id of new group chat, creator is its first member
+		std::pair<Error, std::optional<size_t>> addGroupChat(size_t creatorId);
+		// returns true if member was added to group chat
+		std::pair<Error, bool> addChatMember(size_t chatId, size_t userId);
+		// returns true if member was deleted
+		std::pair<Error, bool> deleteChatMember(size_t chatId, size_t userId);
+		// returns all {chatId, userId} pairs of group chats
+		std::pair<Error, std::vector<std::pair<size_t, size_t>>> getChatMembers();
 		// returns true if chat was deleted
 		std::pair<Error, bool> deleteChat(size_t whoId, size_t withId);
 		// returns true if chat was deleted
@@ -108,12 +120,31 @@ namespace db {
 		std::pair<Error, bool> deleteTxtMessage(size_t id);
 		// returns vector of txt message fields
 		std::pair<Error, std::vector<TxtMessage>> getTxtMessagesForChat(size_t chatId);
+		// returns up to 'count' latest txt messages of every chat from chatIds, in one query
+		std::pair<Error, std::vector<TxtMessage>> getLastTxtMessagesForChats(std::span<const size_t> chatIds, size_t count);
+		// returns txt messages with given ids, newest first
+		std::pair<Error, std::vector<TxtMessage>> getTxtMessagesByIds(std::span<const size_t> ids);
+		// returns up to 'count' txt messages with id greater than afterId, oldest first
+		std::pair<Error, std::vector<TxtMessage>> getTxtMessagesAfterId(size_t afterId, size_t count);
+		// references blobs (sha256 of storage files) from message, reference is dropped with message
+		std::pair<Error, bool> addAttachments(size_t messageId, const std::vector<std::string>& hashes);
+		// returns those of hashes that are referenced by any message
+		std::pair<Error, std::vector<std::string>> getReferencedBlobs(const std::vector<std::string>& hashes);
+		// user may attach blob only after uploading it
+		std::pair<Error, bool> addBlobOwner(size_t userId, const std::string& hash);
+		// returns those of hashes that user has uploaded
+		std::pair<Error, std::vector<std::string>> getOwnedBlobs(size_t userId, const std::vector<std::string>& hashes);
 
 		void createTables();
+		// brings tables of older versions up to date, safe to run on every start
+		void migrate();
 		void deleteTables();
 		void cleanDb();
 	private:
 		std::unique_ptr<db::IDb> db;
+		// transactions run on their own connection, statements of other threads on db can't get into them
+		std::mutex txMtx;
+		std::unique_ptr<db::IDb> txDb;
 	};
 
 }
@@ -0,0 +1,167 @@
+#include "Metrics.hpp"
+#include <format>
+#include <stdexcept>
+
+namespace {
+
+	// Prometheus 'le' bounds of exported histograms, in microseconds
+	constexpr std::array<uint64_t, 16> ExportBoundsMcs{
+		100, 250, 500,
+		1000, 2500, 5000,
+		10000, 25000, 50000,
+		100000, 250000, 500000,
+		1000000, 2500000, 5000000,
+		10000000
+	};
+
+	std::string withLabels(const std::string& labels, const std::string& extra = "") {
+		if (labels.empty() && extra.empty()) {
+			return "";
+		}
+		if (labels.empty() || extra.empty()) {
+			return "{" + labels + extra + "}";
+		}
+		return "{" + labels + "," + extra + "}";
+	}
+
+}
+
+Metrics& Metrics::get() {
+	static Metrics metrics;
+	return metrics;
+}
+
+size_t Metrics::counter(const std::string& name, const std::string& help, const std::string& labels) {
+	std::unique_lock<std::mutex> lck{ mtx };
+	if (countersCnt == MaxCounters) {
+		throw std::logic_error(std::format("too many counters, can't register {}", name));
+	}
+	size_t id = countersCnt++;
+	family(name, help, Type::Counter).series.push_back({ labels, id, nullptr });
+	return id;
+}
+
+void Metrics::counter(const std::string& name, const std::string& help, std::function<double()> fn, const std::string& labels) {
+	std::unique_lock<std::mutex> lck{ mtx };
+	family(name, help, Type::Counter).series.push_back({ labels, 0, std::move(fn) });
+}
+
+size_t Metrics::histogram(const std::string& name, const std::string& help, const std::string& labels) {
+	std::unique_lock<std::mutex> lck{ mtx };
+	if (histogramsCnt == MaxHistograms) {
+		throw std::logic_error(std::format("too many histograms, can't register {}", name));
+	}
+	size_t id = histogramsCnt++;
+	family(name, help, Type::Histogram).series.push_back({ labels, id, nullptr });
+	return id;
+}
+
+void Metrics::gauge(const std::string& name, const std::string& help, std::function<double()> fn, const std::string& labels) {
+	std::unique_lock<std::mutex> lck{ mtx };
+	family(name, help, Type::Gauge).series.push_back({ labels, 0, std::move(fn) });
+}
+
+std::string Metrics::prometheus() {
+	std::unique_lock<std::mutex> lck{ mtx };
+	std::string res;
+	for (const auto& fam : families) {
+		res += std::format("# HELP {} {}\n", fam.name, fam.help);
+		switch (fam.type) {
+		case Type::Counter:
+			res += std::format("# TYPE {} counter\n", fam.name);
+			for (const auto& series : fam.series) {
+				if (series.valueFn) {
+					res += std::format("{}{} {}\n", fam.name, withLabels(series.labels), series.valueFn());
+					continue;
+				}
+				uint64_t value = 0;
+				for (const auto& thread : threads) {
+					value += thread->counters[series.id].load(std::memory_order_relaxed);
+				}
+				res += std::format("{}{} {}\n", fam.name, withLabels(series.labels), value);
+			}
+			break;
+		case Type::Gauge:
+			res += std::format("# TYPE {} gauge\n", fam.name);
+			for (const auto& series : fam.series) {
+				res += std::format("{}{} {}\n", fam.name, withLabels(series.labels), series.valueFn());
+			}
+			break;
+		case Type::Histogram:
+			res += std::format("# TYPE {} histogram\n", fam.name);
+			for (const auto& series : fam.series) {
+				std::array<uint64_t, Buckets> merged{};
+				uint64_t sum = 0;
+				for (const auto& thread : threads) {
+					const HistogramSlots* histogram = thread->histograms[series.id].load(std::memory_order_acquire);
+					if (!histogram) {
+						continue;
+					}
+					for (size_t i = 0; i < Buckets; ++i) {
+						merged[i] += histogram->buckets[i].load(std::memory_order_relaxed);
+					}
+					sum += histogram->sum.load(std::memory_order_relaxed);
+				}
+				uint64_t cumulative = 0;
+				size_t bucket = 0;
+				for (auto bound : ExportBoundsMcs) {
+					for (; (bucket < Buckets) && (bucketUpperBound(bucket) <= bound); ++bucket) {
+						cumulative += merged[bucket];
+					}
+					res += std::format("{}_bucket{} {}\n", fam.name, withLabels(series.labels, std::format("le=\"{}\"", (double)bound / 1e6)), cumulative);
+				}
+				for (; bucket < Buckets; ++bucket) {
+					cumulative += merged[bucket];
+				}
+				res += std::format("{}_bucket{} {}\n", fam.name, withLabels(series.labels, "le=\"+Inf\""), cumulative);
+				res += std::format("{}_sum{} {}\n", fam.name, withLabels(series.labels), (double)sum / 1e6);
+				res += std::format("{}_count{} {}\n", fam.name, withLabels(series.labels), cumulative);
+			}
+			break;
+		}
+	}
+	return res;
+}
+
+uint64_t Metrics::bucketUpperBound(size_t bucket) {
+	if (bucket < SubBuckets) {
+		return bucket;
+	}
+	size_t msb = bucket / SubBuckets + SubBucketBits - 1;
+	uint64_t sub = bucket % SubBuckets;
+	uint64_t lower = (SubBuckets + sub) << (msb - SubBucketBits);
+	return lower + (uint64_t(1) << (msb - SubBucketBits)) - 1;
+}
+
+Metrics::Family& Metrics::family(const std::string& name, const std::string& help, Type type) {
+	for (auto& fam : families) {
+		if (fam.name == name) {
+			if (fam.type != type) {
+				throw std::logic_error(std::format("metric {} is registered with different type", name));
+			}
+			return fam;
+		}
+	}
+	families.push_back({ name, help, type, {} });
+	return families.back();
+}
+
+Metrics::ThreadSlots& Metrics::registerThread() {
+	auto slots = std::make_unique<ThreadSlots>();
+	std::unique_lock<std::mutex> lck{ mtx };
+	threads.push_back(std::move(slots));
+	return *threads.back();
+}
+
+Metrics::HistogramSlots& Metrics::allocHistogram(ThreadSlots& slots, size_t id) {
+	auto* histogram = new HistogramSlots();
+	// release pairs with acquire of scrape, it must not see unconstructed slots
+	slots.histograms[id].store(histogram, std::memory_order_release);
+	return *histogram;
+}
+
+Metrics::ThreadSlots::~ThreadSlots() {
+	for (auto& histogram : histograms) {
+		delete histogram.load(std::memory_order_relaxed);
+	}
+}
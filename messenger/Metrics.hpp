@@ -0,0 +1,146 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "profiling.hpp"
+
+/*
+	Process metrics in Prometheus text format.
+	Counters and latency histograms are registered once at startup and updated by id.
+	Every thread writes only to its own slots (plain relaxed stores, no locked instructions),
+	slots of all threads are summed on scrape.
+	Histogram slots are allocated by thread on its first observation, so threads pay only for histograms they use.
+	Histograms are log-linear (HDR-like): 8 sub-buckets per power of two of microseconds.
+*/
+class Metrics {
+public:
+	static constexpr size_t MaxCounters = 256;
+	static constexpr size_t MaxHistograms = 1024;
+	static constexpr size_t SubBucketBits = 3;
+	static constexpr size_t SubBuckets = size_t(1) << SubBucketBits;
+	// values above 2^MaxValueBits mcs (~12 days) go to the last bucket
+	static constexpr size_t MaxValueBits = 40;
+	static constexpr size_t Buckets = (MaxValueBits - SubBucketBits + 1) * SubBuckets;
+
+	static Metrics& get();
+
+	// labels are Prometheus label pairs without braces, e.g. route="/chat",method="GET"
+	size_t counter(const std::string& name, const std::string& help, const std::string& labels = "");
+	// counter kept by its owner, fn returns monotonic total and is called on scrape
+	void counter(const std::string& name, const std::string& help, std::function<double()> fn, const std::string& labels = "");
+	size_t histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+	// fn is called on scrape
+	void gauge(const std::string& name, const std::string& help, std::function<double()> fn, const std::string& labels = "");
+
+	inline void inc(size_t id, uint64_t value = 1);
+	inline void observe(size_t id, uint64_t valueMcs);
+	std::string prometheus();
+
+	static inline size_t bucketOf(uint64_t value);
+	// largest value that falls into bucket
+	static uint64_t bucketUpperBound(size_t bucket);
+
+private:
+	enum class Type {
+		Counter,
+		Gauge,
+		Histogram
+	};
+
+	struct Series {
+		std::string labels;
+		// counter or histogram id
+		size_t id = 0;
+		// gauge or externally kept counter
+		std::function<double()> valueFn;
+	};
+
+	struct Family {
+		std::string name;
+		std::string help;
+		Type type;
+		std::vector<Series> series;
+	};
+
+	struct HistogramSlots {
+		std::array<std::atomic<uint64_t>, Buckets> buckets{};
+		std::atomic<uint64_t> sum{ 0 };
+	};
+
+	struct ThreadSlots {
+		std::array<std::atomic<uint64_t>, MaxCounters> counters{};
+		// nullptr until thread observes histogram
+		std::array<std::atomic<HistogramSlots*>, MaxHistograms> histograms{};
+		~ThreadSlots();
+	};
+
+	Metrics() = default;
+	Family& family(const std::string& name, const std::string& help, Type type);
+	ThreadSlots& threadSlots();
+	ThreadSlots& registerThread();
+	static HistogramSlots& allocHistogram(ThreadSlots& slots, size_t id);
+	static inline void add(std::atomic<uint64_t>& slot, uint64_t value);
+
+	std::mutex mtx;
+	std::vector<Family> families;
+	std::vector<std::unique_ptr<ThreadSlots>> threads;
+	size_t countersCnt = 0;
+	size_t histogramsCnt = 0;
+};
+
+// records time from construction to destruction into histogram
+class ScopedTimer {
+public:
+	inline ScopedTimer(size_t histogramId) : id{ histogramId }, start{ util::prof::tsMcs() } {}
+	inline ~ScopedTimer() { Metrics::get().observe(id, util::prof::tsMcs() - start); }
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+	size_t id;
+	size_t start;
+};
+
+inline void Metrics::add(std::atomic<uint64_t>& slot, uint64_t value) {
+	// only owning thread writes the slot
+	slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline Metrics::ThreadSlots& Metrics::threadSlots() {
+	thread_local ThreadSlots* slots = nullptr;
+	if (!slots) {
+		slots = &registerThread();
+	}
+	return *slots;
+}
+
+inline void Metrics::inc(size_t id, uint64_t value) {
+	add(threadSlots().counters[id], value);
+}
+
+inline void Metrics::observe(size_t id, uint64_t valueMcs) {
+	auto& slots = threadSlots();
+	HistogramSlots* histogram = slots.histograms[id].load(std::memory_order_relaxed);
+	if (!histogram) {
+		histogram = &allocHistogram(slots, id);
+	}
+	add(histogram->buckets[bucketOf(valueMcs)], 1);
+	add(histogram->sum, valueMcs);
+}
+
+inline size_t Metrics::bucketOf(uint64_t value) {
+	if (value < SubBuckets) {
+		return value;
+	}
+	value = std::min(value, (uint64_t(1) << MaxValueBits) - 1);
+	size_t msb = 63 - std::countl_zero(value);
+	size_t sub = (value >> (msb - SubBucketBits)) & (SubBuckets - 1);
+	return (msb - SubBucketBits + 1) * SubBuckets + sub;
+}
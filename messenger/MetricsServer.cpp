@@ -0,0 +1,102 @@
+#include "MetricsServer.hpp"
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Metrics.hpp"
+
+namespace {
+	void writeAll(int fd, std::string_view data) {
+		while (!data.empty()) {
+			auto written = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return;
+			}
+			data.remove_prefix((size_t)written);
+		}
+	}
+
+	std::string makeResponse(std::string_view status, std::string_view contentType, std::string_view body) {
+		return std::format("HTTP/1.1 {}\r\nContent-Type: {}\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}", status, contentType, body.size(), body);
+	}
+}
+
+MetricsServer::MetricsServer(uint16_t port) {
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int reuse = 1;
+	listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if ((listenFd < 0)
+		|| (::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0)
+		|| (::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0)
+		|| (::listen(listenFd, 16) != 0))
+	{
+		int err = errno;
+		if (listenFd >= 0) {
+			::close(listenFd);
+		}
+		throw std::runtime_error(std::format("can't listen on metrics port {}: {}", port, std::strerror(err)));
+	}
+	worker = std::thread([this]() { run(); });
+}
+
+MetricsServer::~MetricsServer() {
+	// wakes up accept
+	::shutdown(listenFd, SHUT_RDWR);
+	worker.join();
+	::close(listenFd);
+}
+
+void MetricsServer::run() {
+	while (true) {
+		int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			// listening socket is shut down
+			return;
+		}
+		serve(fd);
+		::close(fd);
+	}
+}
+
+void MetricsServer::serve(int fd) {
+	timeval timeout{ (time_t)(IoTimeoutMs / 1000), (suseconds_t)(IoTimeoutMs % 1000 * 1000) };
+	::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	std::string request;
+	while (request.find("\r\n\r\n") == std::string::npos) {
+		if (request.size() >= MaxRequestSize) {
+			return;
+		}
+		char buf[1024];
+		auto got = ::recv(fd, buf, sizeof(buf), 0);
+		if ((got < 0) && (errno == EINTR)) {
+			continue;
+		}
+		if (got <= 0) {
+			return;
+		}
+		request.append(buf, (size_t)got);
+	}
+	std::string_view line = std::string_view(request).substr(0, request.find("\r\n"));
+	if (line.starts_with("GET /metrics ")) {
+		writeAll(fd, makeResponse("200 OK", "text/plain; version=0.0.4", Metrics::get().prometheus()));
+	}
+	else {
+		writeAll(fd, makeResponse("404 Not Found", "text/plain", ""));
+	}
+}
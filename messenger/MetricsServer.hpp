@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+/*
+	Serves GET /metrics in Prometheus text format on 127.0.0.1 only.
+	Kept apart from public api listener, so access doesn't depend on anything client sends.
+	Scrapes are rare and tiny, so connections are handled one by one by single thread.
+*/
+class MetricsServer {
+public:
+	// scraper that doesn't send request or read response in time is disconnected
+	static constexpr size_t IoTimeoutMs = 2000;
+	static constexpr size_t MaxRequestSize = 8 * 1024;
+
+	MetricsServer(uint16_t port);
+	~MetricsServer();
+	MetricsServer(const MetricsServer&) = delete;
+	MetricsServer& operator=(const MetricsServer&) = delete;
+
+private:
+	void run();
+	void serve(int fd);
+
+	int listenFd = -1;
+	std::thread worker;
+};
@@ -0,0 +1,54 @@
+#include "RequestArena.hpp"
+#include <atomic>
+
+namespace {
+
+	thread_local RequestArena* activeArena = nullptr;
+	std::atomic<size_t> spillsCnt{ 0 };
+
+}
+
+RequestArena::RequestArena()
+	: blocks{ threadBlocks() },
+	// nested arena (handler calling handler) gets memory from pool only
+	ownsInitial{ !blocks.initialInUse },
+	spill{ &blocks.pool },
+	arena{ ownsInitial ? std::pmr::monotonic_buffer_resource(blocks.initial.get(), BlockSize, &spill) : std::pmr::monotonic_buffer_resource(&spill) },
+	prev{ activeArena }
+{
+	blocks.initialInUse = true;
+	activeArena = this;
+}
+
+RequestArena::~RequestArena() {
+	activeArena = prev;
+	if (ownsInitial) {
+		blocks.initialInUse = false;
+	}
+	if (spill.allocations) {
+		spillsCnt.fetch_add(1, std::memory_order_relaxed);
+	}
+	// arena memory goes back to initial block and pool here
+}
+
+std::pmr::memory_resource* RequestArena::current() {
+	return activeArena ? activeArena->resource() : std::pmr::get_default_resource();
+}
+
+size_t RequestArena::spills() {
+	return spillsCnt.load(std::memory_order_relaxed);
+}
+
+void* RequestArena::SpillResource::do_allocate(size_t bytes, size_t alignment) {
+	++allocations;
+	return upstream->allocate(bytes, alignment);
+}
+
+void RequestArena::SpillResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+	upstream->deallocate(p, bytes, alignment);
+}
+
+RequestArena::ThreadBlocks& RequestArena::threadBlocks() {
+	thread_local ThreadBlocks threadBlocks;
+	return threadBlocks;
+}
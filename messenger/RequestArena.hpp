@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+/*
+	Memory of one request: temporary containers of handler allocate from monotonic buffer
+	and are freed all at once when request ends.
+	Every thread owns one initial block and a pool for what does not fit into it,
+	so after warm up requests on this thread do not call malloc for arena memory at all.
+	Containers allocated from arena must not outlive the request.
+*/
+class RequestArena {
+public:
+	static constexpr size_t BlockSize = 64 * 1024;
+
+	RequestArena();
+	~RequestArena();
+	RequestArena(const RequestArena&) = delete;
+	RequestArena& operator=(const RequestArena&) = delete;
+
+	inline std::pmr::memory_resource* resource() { return &arena; }
+	// arena of request handled by this thread, default resource outside of request
+	static std::pmr::memory_resource* current();
+	// requests that needed more than initial block, for tuning BlockSize
+	static size_t spills();
+
+private:
+	// upstream of arena, counts allocations past initial block
+	class SpillResource : public std::pmr::memory_resource {
+	public:
+		SpillResource(std::pmr::memory_resource* upstream) : upstream{ upstream } {}
+		size_t allocations = 0;
+	private:
+		void* do_allocate(size_t bytes, size_t alignment) override;
+		void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+		std::pmr::memory_resource* upstream;
+	};
+
+	struct ThreadBlocks {
+		std::unique_ptr<std::byte[]> initial = std::make_unique<std::byte[]>(BlockSize);
+		// blocks of spilled requests are kept for next requests
+		std::pmr::unsynchronized_pool_resource pool;
+		bool initialInUse = false;
+	};
+
+	static ThreadBlocks& threadBlocks();
+
+	ThreadBlocks& blocks;
+	bool ownsInitial;
+	SpillResource spill;
+	std::pmr::monotonic_buffer_resource arena;
+	RequestArena* prev;
+};
@@ -0,0 +1,446 @@
+#include "SearchIndex.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include "AsyncLog.hpp"
+
+namespace {
+
+	constexpr char SegmentMagic[8] = { 'M', 'S', 'G', 'I', 'D', 'X', '0', '1' };
+	constexpr std::string_view SegmentPrefix = "seg-";
+	constexpr std::string_view SegmentExt = ".idx";
+
+	template<typename T>
+	void writeRaw(std::ofstream& out, T value) {
+		out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	template<typename T>
+	bool readRaw(std::string_view& in, T& value) {
+		if (in.size() < sizeof(value)) {
+			return false;
+		}
+		std::memcpy(&value, in.data(), sizeof(value));
+		in.remove_prefix(sizeof(value));
+		return true;
+	}
+
+	bool readBytes(std::string_view& in, size_t size, std::string_view& bytes) {
+		if (in.size() < size) {
+			return false;
+		}
+		bytes = in.substr(0, size);
+		in.remove_prefix(size);
+		return true;
+	}
+
+}
+
+SearchIndex::SearchIndex(const std::filesystem::path& _dir)
+	: dir{ _dir }
+{
+	std::filesystem::create_directories(dir);
+	std::vector<std::pair<size_t, std::filesystem::path>> files;
+	for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+		auto name = entry.path().filename().string();
+		if (name.ends_with(".tmp")) {
+			// unfinished write
+			std::filesystem::remove(entry.path());
+			continue;
+		}
+		if (!name.starts_with(SegmentPrefix) || !name.ends_with(SegmentExt)) {
+			continue;
+		}
+		try {
+			files.emplace_back(std::stoull(name.substr(SegmentPrefix.size())), entry.path());
+		}
+		catch (std::exception&) {
+			;
+		}
+	}
+	// older segments first, postings are ordered by segment
+	std::sort(files.begin(), files.end());
+	for (const auto& [number, path] : files) {
+		if (auto segment = load(path); segment) {
+			segments.push_back(segment);
+		}
+		nextSegment = number + 1;
+	}
+	worker = std::thread([this]() { run(); });
+}
+
+SearchIndex::~SearchIndex() {
+	{
+		std::unique_lock<std::mutex> lck{ workMtx };
+		stopped = true;
+	}
+	workCv.notify_one();
+	worker.join();
+}
+
+void SearchIndex::add(size_t chatId, size_t messageId, std::string_view text) {
+	auto terms = tokenize(text);
+	if (terms.empty()) {
+		return;
+	}
+	bool flush = false;
+	std::string k;
+	{
+		std::unique_lock<std::shared_mutex> lck{ mtx };
+		for (const auto& term : terms) {
+			makeKey(chatId, term, k);
+			memTable[k].push_back(messageId);
+		}
+		memPostings += terms.size();
+		memMaxId = std::max(memMaxId, messageId);
+		flush = (memPostings >= FlushPostings) && !frozen;
+	}
+	if (flush) {
+		workCv.notify_one();
+	}
+}
+
+std::pmr::vector<size_t> SearchIndex::search(std::span<const size_t> chatIds, std::string_view query, size_t limit, std::pmr::memory_resource* resource) {
+	std::pmr::vector<size_t> res{ resource };
+	auto terms = tokenize(query, resource);
+	if (terms.empty()) {
+		return res;
+	}
+	std::pmr::vector<std::pmr::string> keys{ resource };
+	keys.reserve(chatIds.size() * terms.size());
+	for (auto chatId : chatIds) {
+		for (const auto& term : terms) {
+			makeKey(chatId, term, keys.emplace_back());
+		}
+	}
+	// postings of memory table are copied, segments are immutable and searched without lock
+	std::pmr::vector<PostingsBuf> memParts{ resource };
+	memParts.reserve(keys.size());
+	std::vector<SegmentPtr> curSegments;
+	std::shared_ptr<const MemTable> curFrozen;
+	{
+		std::shared_lock<std::shared_mutex> lck{ mtx };
+		curSegments = segments;
+		curFrozen = frozen;
+		for (const auto& k : keys) {
+			auto& part = memParts.emplace_back();
+			if (auto iter = memTable.find(std::string_view(k)); iter != memTable.end()) {
+				part.assign(iter->second.begin(), iter->second.end());
+			}
+		}
+	}
+	PostingsBuf matched{ resource };
+	PostingsBuf termPostings{ resource };
+	PostingsBuf intersection{ resource };
+	for (size_t i = 0; i < keys.size(); i += terms.size()) {
+		matched.clear();
+		for (size_t j = 0; j < terms.size(); ++j) {
+			std::string_view k = keys[i + j];
+			termPostings.clear();
+			for (const auto& segment : curSegments) {
+				segment->find(k, termPostings);
+			}
+			if (curFrozen) {
+				if (auto iter = curFrozen->find(k); iter != curFrozen->end()) {
+					termPostings.insert(termPostings.end(), iter->second.begin(), iter->second.end());
+				}
+			}
+			termPostings.insert(termPostings.end(), memParts[i + j].begin(), memParts[i + j].end());
+			// segments may overlap if process stopped between merge and removal of merged files
+			std::sort(termPostings.begin(), termPostings.end());
+			termPostings.erase(std::unique(termPostings.begin(), termPostings.end()), termPostings.end());
+			if (j == 0) {
+				matched.swap(termPostings);
+			}
+			else {
+				intersection.clear();
+				std::set_intersection(matched.begin(), matched.end(), termPostings.begin(), termPostings.end(), std::back_inserter(intersection));
+				matched.swap(intersection);
+			}
+			if (matched.empty()) {
+				break;
+			}
+		}
+		res.insert(res.end(), matched.begin(), matched.end());
+	}
+	std::sort(res.begin(), res.end(), std::greater<size_t>());
+	if (res.size() > limit) {
+		res.resize(limit);
+	}
+	return res;
+}
+
+size_t SearchIndex::persistedMaxId() const {
+	std::shared_lock<std::shared_mutex> lck{ mtx };
+	size_t res = 0;
+	for (const auto& segment : segments) {
+		res = std::max(res, segment->maxId);
+	}
+	return res;
+}
+
+std::pmr::vector<std::pmr::string> SearchIndex::tokenize(std::string_view text, std::pmr::memory_resource* resource) {
+	std::pmr::vector<std::pmr::string> res{ resource };
+	std::pmr::string term{ resource };
+	auto flush = [&]() {
+		if (!term.empty() && (term.size() <= MaxTermLength)) {
+			res.push_back(term);
+		}
+		term.clear();
+	};
+	for (char c : text) {
+		unsigned char uc = (unsigned char)c;
+		// non ascii bytes are kept as is, so utf-8 words are terms too
+		if (std::isalnum(uc) || (uc >= 0x80)) {
+			term += (char)std::tolower(uc);
+		}
+		else {
+			flush();
+		}
+	}
+	flush();
+	std::sort(res.begin(), res.end());
+	res.erase(std::unique(res.begin(), res.end()), res.end());
+	return res;
+}
+
+void SearchIndex::Segment::find(std::string_view k, PostingsBuf& out) const {
+	auto iter = std::lower_bound(keys.begin(), keys.end(), k);
+	if ((iter != keys.end()) && (*iter == k)) {
+		size_t idx = iter - keys.begin();
+		decode(std::string_view(postings).substr(offsets[idx], offsets[idx + 1] - offsets[idx]), out);
+	}
+}
+
+template<typename String>
+void SearchIndex::makeKey(size_t chatId, std::string_view term, String& out) {
+	// big endian chat id, so keys of one chat are adjacent in sorted segment
+	out.assign(sizeof(uint64_t), '\0');
+	for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+		out[i] = (char)(((uint64_t)chatId >> (8 * (sizeof(uint64_t) - 1 - i))) & 0xff);
+	}
+	out += term;
+}
+
+void SearchIndex::encode(std::span<const uint64_t> postings, std::string& out) {
+	uint64_t prev = 0;
+	for (auto id : postings) {
+		uint64_t delta = id - prev;
+		prev = id;
+		while (delta >= 0x80) {
+			out += (char)((delta & 0x7f) | 0x80);
+			delta >>= 7;
+		}
+		out += (char)delta;
+	}
+}
+
+void SearchIndex::decode(std::string_view data, PostingsBuf& out) {
+	uint64_t prev = 0;
+	uint64_t delta = 0;
+	size_t shift = 0;
+	for (char c : data) {
+		unsigned char uc = (unsigned char)c;
+		delta |= (uint64_t)(uc & 0x7f) << shift;
+		if (uc & 0x80) {
+			shift += 7;
+			continue;
+		}
+		prev += delta;
+		out.push_back(prev);
+		delta = 0;
+		shift = 0;
+	}
+}
+
+std::shared_ptr<SearchIndex::Segment> SearchIndex::build(const MemTable& table, size_t maxId) {
+	auto segment = std::make_shared<Segment>();
+	segment->maxId = maxId;
+	segment->keys.reserve(table.size());
+	for (const auto& [k, postings] : table) {
+		segment->keys.push_back(k);
+	}
+	std::sort(segment->keys.begin(), segment->keys.end());
+	segment->offsets.reserve(segment->keys.size() + 1);
+	for (const auto& k : segment->keys) {
+		segment->offsets.push_back(segment->postings.size());
+		encode(table.at(k), segment->postings);
+	}
+	segment->offsets.push_back(segment->postings.size());
+	return segment;
+}
+
+std::shared_ptr<SearchIndex::Segment> SearchIndex::merge(const std::vector<SegmentPtr>& parts) {
+	auto segment = std::make_shared<Segment>();
+	for (const auto& part : parts) {
+		segment->maxId = std::max(segment->maxId, part->maxId);
+		segment->keys.insert(segment->keys.end(), part->keys.begin(), part->keys.end());
+	}
+	std::sort(segment->keys.begin(), segment->keys.end());
+	segment->keys.erase(std::unique(segment->keys.begin(), segment->keys.end()), segment->keys.end());
+	segment->offsets.reserve(segment->keys.size() + 1);
+	PostingsBuf postings;
+	for (const auto& k : segment->keys) {
+		postings.clear();
+		for (const auto& part : parts) {
+			part->find(k, postings);
+		}
+		std::sort(postings.begin(), postings.end());
+		postings.erase(std::unique(postings.begin(), postings.end()), postings.end());
+		segment->offsets.push_back(segment->postings.size());
+		encode(postings, segment->postings);
+	}
+	segment->offsets.push_back(segment->postings.size());
+	return segment;
+}
+
+std::vector<SearchIndex::SegmentPtr> SearchIndex::pickMerge(const std::vector<SegmentPtr>& segments) {
+	if (segments.size() < MergeSegments) {
+		return {};
+	}
+	// postings dominate segment size
+	std::vector<size_t> bySize(segments.size());
+	for (size_t i = 0; i < bySize.size(); ++i) {
+		bySize[i] = i;
+	}
+	std::sort(bySize.begin(), bySize.end(), [&segments](size_t l, size_t r) { return segments[l]->postings.size() < segments[r]->postings.size(); });
+	// smallest similar segments first, they are the cheapest to merge
+	for (size_t i = 0; i + MergeSegments <= bySize.size(); ++i) {
+		size_t smallest = std::max<size_t>(segments[bySize[i]]->postings.size(), 1);
+		size_t largest = segments[bySize[i + MergeSegments - 1]]->postings.size();
+		if (largest <= smallest * MergeSizeRatio) {
+			std::sort(bySize.begin() + i, bySize.begin() + i + MergeSegments);
+			std::vector<SegmentPtr> res;
+			for (size_t j = i; j < i + MergeSegments; ++j) {
+				res.push_back(segments[bySize[j]]);
+			}
+			return res;
+		}
+	}
+	return {};
+}
+
+void SearchIndex::save(const Segment& segment) {
+	auto path = segmentPath(segment.number);
+	auto tmpPath = path;
+	tmpPath += ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		out.write(SegmentMagic, sizeof(SegmentMagic));
+		writeRaw<uint64_t>(out, segment.maxId);
+		writeRaw<uint64_t>(out, segment.keys.size());
+		for (size_t i = 0; i < segment.keys.size(); ++i) {
+			writeRaw<uint32_t>(out, (uint32_t)segment.keys[i].size());
+			out.write(segment.keys[i].data(), segment.keys[i].size());
+			writeRaw<uint32_t>(out, (uint32_t)(segment.offsets[i + 1] - segment.offsets[i]));
+			out.write(segment.postings.data() + segment.offsets[i], segment.offsets[i + 1] - segment.offsets[i]);
+		}
+		if (!out) {
+			throw std::runtime_error(std::format("can't write search segment {}", tmpPath.string()));
+		}
+	}
+	// segment appears atomically
+	std::filesystem::rename(tmpPath, path);
+}
+
+SearchIndex::SegmentPtr SearchIndex::load(const std::filesystem::path& path) {
+	std::ifstream in(path, std::ios::binary);
+	std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	std::string_view rest = data;
+	auto segment = std::make_shared<Segment>();
+	segment->number = std::stoull(path.filename().string().substr(SegmentPrefix.size()));
+	std::string_view magic;
+	uint64_t keysCnt = 0;
+	bool ok = readBytes(rest, sizeof(SegmentMagic), magic) && (magic == std::string_view(SegmentMagic, sizeof(SegmentMagic)))
+		&& readRaw(rest, segment->maxId) && readRaw(rest, keysCnt);
+	for (uint64_t i = 0; ok && (i < keysCnt); ++i) {
+		uint32_t keySize = 0;
+		uint32_t postingsSize = 0;
+		std::string_view k;
+		std::string_view postings;
+		ok = readRaw(rest, keySize) && readBytes(rest, keySize, k) && readRaw(rest, postingsSize) && readBytes(rest, postingsSize, postings);
+		if (ok) {
+			segment->keys.emplace_back(k);
+			segment->offsets.push_back(segment->postings.size());
+			segment->postings += postings;
+		}
+	}
+	if (!ok) {
+		alog::error("broken search segment {}, skipping", path.string());
+		return nullptr;
+	}
+	segment->offsets.push_back(segment->postings.size());
+	return segment;
+}
+
+std::filesystem::path SearchIndex::segmentPath(size_t number) const {
+	return dir / std::format("{}{:08}{}", SegmentPrefix, number, SegmentExt);
+}
+
+void SearchIndex::run() {
+	bool stopping = false;
+	while (!stopping) {
+		{
+			std::unique_lock<std::mutex> lck{ workMtx };
+			workCv.wait_for(lck, std::chrono::seconds(1));
+			stopping = stopped;
+		}
+		try {
+			// flushing memory table, on stop - whatever is in it
+			size_t flushedNumber = 0;
+			size_t flushedMaxId = 0;
+			{
+				std::unique_lock<std::shared_mutex> lck{ mtx };
+				if ((memPostings >= FlushPostings) || (stopping && memPostings)) {
+					frozen = std::make_shared<const MemTable>(std::move(memTable));
+					memTable.clear();
+					memPostings = 0;
+					flushedMaxId = memMaxId;
+					flushedNumber = nextSegment++;
+				}
+			}
+			// frozen table is changed only by this thread, so it is read without lock
+			if (flushedNumber) {
+				auto segment = build(*frozen, flushedMaxId);
+				segment->number = flushedNumber;
+				save(*segment);
+				std::unique_lock<std::shared_mutex> lck{ mtx };
+				segments.push_back(segment);
+				frozen.reset();
+			}
+			std::vector<SegmentPtr> parts;
+			size_t mergedNumber = 0;
+			{
+				std::unique_lock<std::shared_mutex> lck{ mtx };
+				if (!stopping) {
+					parts = pickMerge(segments);
+				}
+				if (!parts.empty()) {
+					mergedNumber = nextSegment++;
+				}
+			}
+			if (!parts.empty()) {
+				auto merged = merge(parts);
+				merged->number = mergedNumber;
+				save(*merged);
+				{
+					// only this thread removes segments, so all parts are still there; merged one takes place of the oldest
+					std::unique_lock<std::shared_mutex> lck{ mtx };
+					*std::find(segments.begin(), segments.end(), parts.front()) = merged;
+					std::erase_if(segments, [&parts](const SegmentPtr& segment) { return std::find(parts.begin() + 1, parts.end(), segment) != parts.end(); });
+				}
+				for (const auto& part : parts) {
+					std::filesystem::remove(segmentPath(part->number));
+				}
+			}
+		}
+		catch (std::exception& ex) {
+			alog::error("search index: {}", ex.what());
+		}
+	}
+}
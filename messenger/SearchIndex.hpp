@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory_resource>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Full text index of txt messages, partitioned by chat: every term key is (chatId, term).
+	New messages go to in-memory table, which is frozen into immutable segment when it grows.
+	Segments keep keys sorted and postings (message ids) delta + varint encoded,
+	they are persisted as files in index directory and merged in background.
+	Merge is size tiered: only segments of similar size are merged together, so every posting is rewritten
+	about log(total / flushed) times, not on every merge.
+	Message ids should grow over time, so postings of newer segments follow older ones.
+*/
+class SearchIndex {
+public:
+	// postings in memory table before it is flushed to segment
+	static constexpr size_t FlushPostings = 1 << 20;
+	// segments of similar size that are merged into one
+	static constexpr size_t MergeSegments = 8;
+	// segments are similar if largest of them is at most this times larger than smallest
+	static constexpr size_t MergeSizeRatio = 4;
+	static constexpr size_t MaxTermLength = 64;
+
+	SearchIndex(const std::filesystem::path& dir);
+	~SearchIndex();
+	SearchIndex(const SearchIndex&) = delete;
+	SearchIndex& operator=(const SearchIndex&) = delete;
+
+	void add(size_t chatId, size_t messageId, std::string_view text);
+	// returns ids of messages containing all query terms, newest first; temporaries are allocated from resource
+	std::pmr::vector<size_t> search(std::span<const size_t> chatIds, std::string_view query, size_t limit, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+	// largest message id that is persisted in segments, messages after it should be re-added on start
+	size_t persistedMaxId() const;
+
+	static std::pmr::vector<std::pmr::string> tokenize(std::string_view text, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+private:
+	using Postings = std::vector<uint64_t>;
+	using PostingsBuf = std::pmr::vector<uint64_t>;
+	// allows lookup by string_view, without building std::string key
+	struct KeyHash {
+		using is_transparent = void;
+		inline size_t operator()(std::string_view k) const { return std::hash<std::string_view>()(k); }
+	};
+	using MemTable = std::unordered_map<std::string, Postings, KeyHash, std::equal_to<>>;
+
+	struct Segment {
+		size_t number = 0;
+		size_t maxId = 0;
+		// sorted
+		std::vector<std::string> keys;
+		std::vector<size_t> offsets;
+		std::string postings;
+		// appends postings of key to out
+		void find(std::string_view key, PostingsBuf& out) const;
+	};
+	using SegmentPtr = std::shared_ptr<const Segment>;
+
+	template<typename String>
+	static void makeKey(size_t chatId, std::string_view term, String& out);
+	static void encode(std::span<const uint64_t> postings, std::string& out);
+	static void decode(std::string_view data, PostingsBuf& out);
+
+	std::shared_ptr<Segment> build(const MemTable& table, size_t maxId);
+	std::shared_ptr<Segment> merge(const std::vector<SegmentPtr>& segments);
+	// similar segments to merge, in order of segments, empty if there are none
+	static std::vector<SegmentPtr> pickMerge(const std::vector<SegmentPtr>& segments);
+	void save(const Segment& segment);
+	SegmentPtr load(const std::filesystem::path& path);
+	std::filesystem::path segmentPath(size_t number) const;
+	void run();
+
+	const std::filesystem::path dir;
+	mutable std::shared_mutex mtx;
+	MemTable memTable;
+	size_t memPostings = 0;
+	size_t memMaxId = 0;
+	// memory table being flushed, still searchable
+	std::shared_ptr<const MemTable> frozen;
+	std::vector<SegmentPtr> segments;
+	size_t nextSegment = 1;
+
+	std::mutex workMtx;
+	std::condition_variable workCv;
+	bool stopped = false;
+	std::thread worker;
+};
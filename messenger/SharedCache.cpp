@@ -1,6 +1,16 @@
 #include "SharedCache.hpp"
+#include <algorithm>
+#include "Tracing.hpp"
 
-void SharedCache::init(UsersV&& _users, AddressBooksV&& _addrBooks, ChatsV&& _chats) {
+SharedCache::SharedCache()
+	: lockWaitMetric{ Metrics::get().histogram("messenger_cache_lock_wait_seconds", "Time spent waiting for SharedCache locks") },
+	authHitMetric{ Metrics::get().counter("messenger_cache_auth_total", "Auth checks served by SharedCache", "result=\"hit\"") },
+	authMissMetric{ Metrics::get().counter("messenger_cache_auth_total", "Auth checks served by SharedCache", "result=\"miss\"") }
+{
+	;
+}
+
+void SharedCache::init(UsersV&& _users, AddressBooksV&& _addrBooks, ChatsV&& _chats, ChatMembersV&& _members) {
 	vUsers = std::move(_users);
 	vAddrBooks = std::move(_addrBooks);
 	vChats = std::move(_chats);
@@ -14,41 +24,67 @@ void SharedCache::init(UsersV&& _users, AddressBooksV&& _addrBooks, ChatsV&& _ch
 	}
 	for (auto& chat : vChats) {
 		chat2WhoId[chat.whoId].insert(chat);
-		chat2WithId[chat.withId].insert(chat);
+		if (!chat.isGroup()) {
+			chat2WithId[chat.withId].insert(chat);
+		}
+	}
+	std::unordered_map<size_t, std::vector<size_t>> groups;
+	for (auto [chatId, userId] : _members) {
+		groups[chatId].push_back(userId);
+	}
+	for (auto& [chatId, members] : groups) {
+		auto chatIter = vChats.find(ChatT(chatId));
+		if ((chatIter == vChats.end()) || !chatIter->isGroup()) {
+			continue;
+		}
+		std::sort(members.begin(), members.end());
+		members.erase(std::unique(members.begin(), members.end()), members.end());
+		for (auto userId : members) {
+			chat2MemberId[userId].insert(*chatIter);
+		}
+		chatMembersMap[chatId] = std::make_shared<const std::vector<size_t>>(std::move(members));
 	}
 
 }
 
 void SharedCache::userAdd(UserT _user) {
-	std::unique_lock<std::shared_mutex> lck{ usersMtx };
+	auto lck = writeLock(usersMtx);
 	vUsers.insert(_user);
 	user2Id.emplace(_user.id, _user);
 	user2Username.emplace(_user.username, _user);
 }
 
-bool SharedCache::userIsAuthentificated(size_t id, const std::string& authToken) {
-	std::shared_lock<std::shared_mutex> lck{ usersMtx };
+bool SharedCache::userIsAuthentificated(size_t id, std::string_view authToken) {
+	auto lck = readLock(usersMtx);
 	if (auto iter = user2Id.find(id); iter == user2Id.end()) {
+		Metrics::get().inc(authMissMetric);
 		return false;
 	}
 	else {
 		if (iter->second.authToken != authToken) {
+			Metrics::get().inc(authMissMetric);
 			return false;
 		}
+		Metrics::get().inc(authHitMetric);
 		return true;
 	}
 }
 
 std::optional<size_t> SharedCache::userFind(const std::string& username) {
-	std::shared_lock<std::shared_mutex> lck{ usersMtx };
+	auto lck = readLock(usersMtx);
 	if (auto iter = user2Username.find(username); iter != user2Username.end()) {
 		return iter->second.id;
 	}
 	return std::nullopt;
 }
 
+bool SharedCache::userExists(size_t id) {
+	auto lck = readLock(usersMtx);
+	return user2Id.contains(id);
+}
+
 SharedCache::UsersV SharedCache::usersFindById(const std::unordered_set<size_t>& ids) {
-	std::shared_lock<std::shared_mutex> lck{ usersMtx };
+	auto lck = readLock(usersMtx);
 	UsersV users;
 	for (auto id : ids) {
 		if (auto iter = user2Id.find(id); iter != user2Id.end()) {
@@ -59,7 +95,7 @@ SharedCache::UsersV SharedCache::usersFindById(const std::unordered_set<size_t>&
 }
 
 std::pair<size_t, std::string> SharedCache::userLogin(const std::string& username, const std::string& pwdHash) {
-	std::shared_lock<std::shared_mutex> lck{ usersMtx };
+	auto lck = readLock(usersMtx);
 	if (auto iter = user2Username.find(username); iter == user2Username.end()) {
 		return { 0, "" };
 	}
@@ -72,13 +108,13 @@ std::pair<size_t, std::string> SharedCache::userLogin(const std::string& usernam
 }
 
 void SharedCache::contactAdd(const AddressBookT& _entry) {
-	std::unique_lock<std::shared_mutex> lck{ addrBooksMtx };
+	auto lck = writeLock(addrBooksMtx);
 	vAddrBooks.insert(_entry);
 	addrBook2WhoId[_entry.whoId].insert(_entry);
 }
 
 SharedCache::AddressBooksV SharedCache::contactGetForId(size_t whoId) {
-	std::shared_lock<std::shared_mutex> lck{ addrBooksMtx };
+	auto lck = readLock(addrBooksMtx);
 	if (auto iter = addrBook2WhoId.find(whoId); iter != addrBook2WhoId.end()) {
 		return iter->second;
 	}
@@ -86,7 +122,7 @@ SharedCache::AddressBooksV SharedCache::contactGetForId(size_t whoId) {
 }
 
 bool SharedCache::contactDelete(size_t contactId, size_t whoId) {
-	std::unique_lock<std::shared_mutex> lck{ addrBooksMtx };
+	auto lck = writeLock(addrBooksMtx);
 	AddressBookT dummyAddrBook(contactId);
 	if (!vAddrBooks.erase(dummyAddrBook)) {
 		return false;
@@ -103,14 +139,20 @@ bool SharedCache::contactDelete(size_t contactId, size_t whoId) {
 }
 
 void SharedCache::chatAdd(const ChatT& chat) {
-	std::unique_lock<std::shared_mutex> lck{ chatsMtx };
+	auto lck = writeLock(chatsMtx);
 	vChats.insert(chat);
 	chat2WhoId[chat.whoId].insert(chat);
-	chat2WithId[chat.withId].insert(chat);
+	if (chat.isGroup()) {
+		// creator is the first member
+		chatMemberAddLocked(chat.id, chat.whoId);
+	}
+	else {
+		chat2WithId[chat.withId].insert(chat);
+	}
 }
 
 SharedCache::ChatsV SharedCache::chatsGetForId(size_t userId) {
-	std::shared_lock<std::shared_mutex> lck{ chatsMtx };
+	auto lck = readLock(chatsMtx);
 	auto iWho = chat2WhoId.end();
 	auto iWith = chat2WithId.end();
 	iWho = chat2WhoId.find(userId);
@@ -122,20 +164,112 @@ SharedCache::ChatsV SharedCache::chatsGetForId(size_t userId) {
 	if (iWith != chat2WithId.end()) {
 		res.insert(iWith->second.begin(), iWith->second.end());
 	}
+	if (auto iMember = chat2MemberId.find(userId); iMember != chat2MemberId.end()) {
+		res.insert(iMember->second.begin(), iMember->second.end());
+	}
 	return res;
 }
 
 bool SharedCache::chatDelete(size_t chatId, size_t userId) {
-	std::unique_lock<std::shared_mutex> lck{ chatsMtx };
-	ChatT dummyChat(chatId);
-	if (!vChats.erase(dummyChat)) {
+	auto lck = writeLock(chatsMtx);
+	auto chatIter = vChats.find(ChatT(chatId));
+	if (chatIter == vChats.end()) {
 		return false;
 	}
-	if (auto iter = chat2WhoId.find(userId); iter != chat2WhoId.end()) {
-		iter->second.erase(dummyChat);
+	ChatT chat = *chatIter;
+	if ((chat.whoId != userId) && (chat.isGroup() || (chat.withId != userId))) {
+		return false;
+	}
+	vChats.erase(chatIter);
+	if (auto iter = chat2WhoId.find(chat.whoId); iter != chat2WhoId.end()) {
+		iter->second.erase(chat);
 	}
-	if (auto iter = chat2WithId.find(userId); iter != chat2WhoId.end()) {
-		iter->second.erase(dummyChat);
+	if (auto iter = chat2WithId.find(chat.withId); iter != chat2WithId.end()) {
+		iter->second.erase(chat);
+	}
+	if (auto iter = chatMembersMap.find(chatId); iter != chatMembersMap.end()) {
+		for (auto memberId : *iter->second) {
+			chat2MemberId[memberId].erase(chat);
+		}
+		chatMembersMap.erase(iter);
 	}
 	return true;
 }
+
+bool SharedCache::chatMemberAdd(size_t chatId, size_t userId) {
+	auto lck = writeLock(chatsMtx);
+	return chatMemberAddLocked(chatId, userId);
+}
+
+bool SharedCache::chatMemberDelete(size_t chatId, size_t userId) {
+	auto lck = writeLock(chatsMtx);
+	auto iter = chatMembersMap.find(chatId);
+	if (iter == chatMembersMap.end()) {
+		return false;
+	}
+	const auto& members = *iter->second;
+	auto pos = std::lower_bound(members.begin(), members.end(), userId);
+	if ((pos == members.end()) || (*pos != userId)) {
+		return false;
+	}
+	// readers may still hold the old vector
+	auto updated = std::make_shared<std::vector<size_t>>(members);
+	updated->erase(updated->begin() + (pos - members.begin()));
+	iter->second = std::move(updated);
+	chat2MemberId[userId].erase(ChatT(chatId));
+	return true;
+}
+
+SharedCache::MembersPtr SharedCache::chatMembers(size_t chatId) {
+	auto lck = readLock(chatsMtx);
+	if (auto iter = chatMembersMap.find(chatId); iter != chatMembersMap.end()) {
+		return iter->second;
+	}
+	return nullptr;
+}
+
+bool SharedCache::chatMemberAddLocked(size_t chatId, size_t userId) {
+	auto chatIter = vChats.find(ChatT(chatId));
+	if ((chatIter == vChats.end()) || !chatIter->isGroup()) {
+		return false;
+	}
+	auto& members = chatMembersMap[chatId];
+	auto updated = members ? std::make_shared<std::vector<size_t>>(*members) : std::make_shared<std::vector<size_t>>();
+	auto pos = std::lower_bound(updated->begin(), updated->end(), userId);
+	if ((pos != updated->end()) && (*pos == userId)) {
+		return false;
+	}
+	updated->insert(pos, userId);
+	members = std::move(updated);
+	chat2MemberId[userId].insert(*chatIter);
+	return true;
+}
+
+std::shared_lock<std::shared_mutex> SharedCache::readLock(std::shared_mutex& mtx) {
+	std::shared_lock<std::shared_mutex> lck{ mtx, std::try_to_lock };
+	if (lck.owns_lock()) {
+		// nothing was waited for, clock reads and span are spent only on contention
+		Metrics::get().observe(lockWaitMetric, 0);
+		return lck;
+	}
+	size_t start = util::prof::tsMcs();
+	lck.lock();
+	size_t end = util::prof::tsMcs();
+	Metrics::get().observe(lockWaitMetric, end - start);
+	Tracer::get().span("cache.lock", start, end);
+	return lck;
+}
+
+std::unique_lock<std::shared_mutex> SharedCache::writeLock(std::shared_mutex& mtx) {
+	std::unique_lock<std::shared_mutex> lck{ mtx, std::try_to_lock };
+	if (lck.owns_lock()) {
+		Metrics::get().observe(lockWaitMetric, 0);
+		return lck;
+	}
+	size_t start = util::prof::tsMcs();
+	lck.lock();
+	size_t end = util::prof::tsMcs();
+	Metrics::get().observe(lockWaitMetric, end - start);
+	Tracer::get().span("cache.lock", start, end);
+	return lck;
+}
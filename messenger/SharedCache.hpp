@@ -1,13 +1,17 @@
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
+#include <string_view>
 #include <mutex>
 #include <shared_mutex>
 #include "MessengerDb.hpp"
+#include "Metrics.hpp"
 
 class SharedCache {
 public:
+	SharedCache();
 	using UserT = db::User;
 	using AddressBookT = db::AddressBook;
 	using ChatT = db::Chat;
@@ -22,12 +26,19 @@ public:
 	using AddressBooksWhoIdMapT = std::unordered_map<size_t, std::unordered_set<AddressBookT>>;
 	// key is whoId
 	using ChatsIdMapT = std::unordered_map<size_t, std::unordered_set<ChatT>>;
+	// sorted member ids of group chat, replaced as a whole on change, so readers may use it without lock
+	using MembersPtr = std::shared_ptr<const std::vector<size_t>>;
+	// key is chatId
+	using ChatMembersMapT = std::unordered_map<size_t, MembersPtr>;
+	// {chatId, userId}
+	using ChatMembersV = std::vector<std::pair<size_t, size_t>>;
 	// key is chatId
 	//using TxtMessageT = std::unordered_map<size_t, db::TxtMessage>;
-	void init(UsersV&& _users, AddressBooksV&& _addrBooks, ChatsV&& _chats);
+	void init(UsersV&& _users, AddressBooksV&& _addrBooks, ChatsV&& _chats, ChatMembersV&& _members);
 	void userAdd(UserT user);
-	bool userIsAuthentificated(size_t id, const std::string& authToken);
+	bool userIsAuthentificated(size_t id, std::string_view authToken);
 	std::optional<size_t> userFind(const std::string& username);
+	bool userExists(size_t id);
 	UsersV usersFindById(const std::unordered_set<size_t>& ids);
 	template<typename T, typename F>
 	UsersV usersFindById(const T& data, F extractor);
@@ -38,8 +49,18 @@ public:
 	bool contactDelete(size_t contactId, size_t whoId);
 	void chatAdd(const ChatT& chat);
 	ChatsV chatsGetForId(size_t userId);
+	// only participant of two-party chat or creator of group chat may delete it
 	bool chatDelete(size_t chatId, size_t userId);
+	bool chatMemberAdd(size_t chatId, size_t userId);
+	bool chatMemberDelete(size_t chatId, size_t userId);
+	// returns nullptr if chat is not a group chat
+	MembersPtr chatMembers(size_t chatId);
 private:
+	bool chatMemberAddLocked(size_t chatId, size_t userId);
+	// locks recording wait time
+	std::shared_lock<std::shared_mutex> readLock(std::shared_mutex& mtx);
+	std::unique_lock<std::shared_mutex> writeLock(std::shared_mutex& mtx);
+
 	UsersV vUsers;
 	AddressBooksV vAddrBooks;
 	ChatsV vChats;
@@ -49,15 +70,23 @@ private:
 	AddressBooksWhoIdMapT addrBook2WhoId;
 	ChatsIdMapT chat2WhoId;
 	ChatsIdMapT chat2WithId;
+	// group chats, key is member id
+	ChatsIdMapT chat2MemberId;
+	ChatMembersMapT chatMembersMap;
 
 	std::shared_mutex usersMtx;
 	std::shared_mutex addrBooksMtx;
 	std::shared_mutex chatsMtx;
+
+	// metric ids
+	size_t lockWaitMetric;
+	size_t authHitMetric;
+	size_t authMissMetric;
 };
 
 template<typename T, typename F>
 SharedCache::UsersV SharedCache::usersFindById(const T& data, F extractor) {
-	std::shared_lock<std::shared_mutex> lck{ usersMtx };
+	auto lck = readLock(usersMtx);
 	UsersV users;
 	for (const auto& elem : data) {
 		auto ids = extractor(elem);
@@ -0,0 +1,93 @@
+#include "TimerWheel.hpp"
+#include <algorithm>
+
+TimerWheel::TimerWheel(size_t tickMs, size_t nowMs)
+	: tickMs{ std::max<size_t>(tickMs, 1) }, startMs{ nowMs }
+{
+	heads.fill(Nil);
+}
+
+TimerWheel::Handle TimerWheel::arm(size_t delayMs, size_t key, size_t nowMs) {
+	uint32_t idx = 0;
+	if (!freeNodes.empty()) {
+		idx = freeNodes.back();
+		freeNodes.pop_back();
+	}
+	else {
+		idx = (uint32_t)nodes.size();
+		nodes.emplace_back();
+	}
+	Node& node = nodes[idx];
+	node.key = key;
+	// counted from current time, not from curTick that lags behind it until next advance(),
+	// rounded up and at least one tick ahead, so timer never fires before delay
+	size_t expireMs = std::max(nowMs, startMs) + delayMs - startMs;
+	node.expireTick = std::max((expireMs + tickMs - 1) / tickMs, curTick + 1);
+	link(idx);
+	return ((Handle)node.generation << 32) | idx;
+}
+
+bool TimerWheel::cancel(Handle handle) {
+	uint32_t idx = (uint32_t)handle;
+	uint32_t generation = (uint32_t)(handle >> 32);
+	if ((idx >= nodes.size()) || (nodes[idx].generation != generation) || (nodes[idx].slot == Nil)) {
+		return false;
+	}
+	unlink(idx);
+	release(idx);
+	return true;
+}
+
+void TimerWheel::link(uint32_t idx) {
+	Node& node = nodes[idx];
+	size_t delta = node.expireTick - curTick;
+	uint32_t slot = 0;
+	if (delta < Slots) {
+		slot = (uint32_t)(node.expireTick & (Slots - 1));
+	}
+	else {
+		// farther timers wait in the last reachable second level slot and are re-placed on cascade
+		size_t tick = curTick + std::min(delta, Slots * (Slots - 1) - 1);
+		slot = (uint32_t)(Slots + ((tick >> SlotBits) & (Slots - 1)));
+	}
+	node.slot = slot;
+	node.prev = Nil;
+	node.next = heads[slot];
+	if (node.next != Nil) {
+		nodes[node.next].prev = idx;
+	}
+	heads[slot] = idx;
+}
+
+void TimerWheel::unlink(uint32_t idx) {
+	Node& node = nodes[idx];
+	if (node.prev != Nil) {
+		nodes[node.prev].next = node.next;
+	}
+	else {
+		heads[node.slot] = node.next;
+	}
+	if (node.next != Nil) {
+		nodes[node.next].prev = node.prev;
+	}
+	node.prev = node.next = Nil;
+}
+
+void TimerWheel::release(uint32_t idx) {
+	Node& node = nodes[idx];
+	node.slot = Nil;
+	// invalidating outstanding handles
+	++node.generation;
+	freeNodes.push_back(idx);
+}
+
+void TimerWheel::cascade() {
+	uint32_t& head = heads[Slots + ((curTick >> SlotBits) & (Slots - 1))];
+	uint32_t idx = head;
+	head = Nil;
+	while (idx != Nil) {
+		uint32_t next = nodes[idx].next;
+		link(idx);
+		idx = next;
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+	Hierarchical hashed timing wheel: two levels of 256 slots.
+	Timers are nodes of intrusive lists stored in one vector, so arm and cancel are O(1)
+	and advancing by one tick touches only timers of one slot.
+	Timers farther than second level are re-placed on cascade and never fire early.
+	Not thread safe.
+*/
+class TimerWheel {
+public:
+	// 0 is never returned by arm()
+	using Handle = uint64_t;
+
+	static constexpr size_t SlotBits = 8;
+	static constexpr size_t Slots = size_t(1) << SlotBits;
+
+	TimerWheel(size_t tickMs, size_t nowMs);
+
+	// key is passed to callback on expiration, timer fires on first advance() at or after nowMs + delayMs
+	Handle arm(size_t delayMs, size_t key, size_t nowMs);
+	// returns false if timer already expired or was cancelled
+	bool cancel(Handle handle);
+	// calls onExpired(key) for every timer expired up to nowMs
+	template<typename F>
+	void advance(size_t nowMs, F&& onExpired);
+	inline size_t size() const { return nodes.size() - freeNodes.size(); }
+	inline size_t tick() const { return tickMs; }
+
+private:
+	static constexpr uint32_t Nil = UINT32_MAX;
+
+	struct Node {
+		size_t key = 0;
+		size_t expireTick = 0;
+		uint32_t prev = Nil;
+		uint32_t next = Nil;
+		uint32_t slot = Nil;
+		uint32_t generation = 1;
+	};
+
+	void link(uint32_t idx);
+	void unlink(uint32_t idx);
+	void release(uint32_t idx);
+	void cascade();
+
+	size_t tickMs;
+	size_t startMs;
+	size_t curTick = 0;
+	std::vector<Node> nodes;
+	std::vector<uint32_t> freeNodes;
+	// first level slots, then second level slots
+	std::array<uint32_t, Slots * 2> heads;
+};
+
+template<typename F>
+void TimerWheel::advance(size_t nowMs, F&& onExpired) {
+	size_t targetTick = (nowMs - startMs) / tickMs;
+	while (curTick < targetTick) {
+		++curTick;
+		if ((curTick & (Slots - 1)) == 0) {
+			cascade();
+		}
+		uint32_t& head = heads[curTick & (Slots - 1)];
+		// detaching slot, so callback can arm new timers
+		uint32_t idx = head;
+		head = Nil;
+		while (idx != Nil) {
+			uint32_t next = nodes[idx].next;
+			size_t key = nodes[idx].key;
+			release(idx);
+			onExpired(key);
+			idx = next;
+		}
+	}
+}
@@ -0,0 +1,110 @@
+#include "Tracing.hpp"
+#include <chrono>
+#include <format>
+#include <stdexcept>
+
+Tracer& Tracer::get() {
+	static Tracer tracer;
+	return tracer;
+}
+
+Tracer::~Tracer() {
+	stop();
+}
+
+void Tracer::start(Options _options) {
+	if (running()) {
+		return;
+	}
+	options = std::move(_options);
+	if (options.sampleEvery == 0) {
+		options.sampleEvery = 1;
+	}
+	out.open(options.path, std::ios::out | std::ios::app);
+	if (!out) {
+		throw std::runtime_error(std::format("can't open trace file {}", options.path));
+	}
+	// JSON array format, Chrome trace viewer accepts it without closing bracket
+	if (out.tellp() == 0) {
+		out << "[\n";
+	}
+	isRunning.store(true);
+	flusher = std::thread([this]() { run(); });
+}
+
+void Tracer::stop() {
+	if (!isRunning.exchange(false)) {
+		return;
+	}
+	flusher.join();
+	out.close();
+}
+
+void Tracer::beginRequest(const char* name) {
+	auto& st = state();
+	st.active = true;
+	st.current.name = name;
+	st.current.spansCnt = 0;
+	st.current.startMcs = util::prof::tsMcs();
+}
+
+void Tracer::endRequest() {
+	auto& st = state();
+	st.active = false;
+	st.current.endMcs = util::prof::tsMcs();
+	bool sampled = (++st.requests % options.sampleEvery) == 0;
+	bool slow = (st.current.endMcs - st.current.startMcs) >= options.thresholdMcs;
+	if (!sampled && !slow) {
+		return;
+	}
+	if (!st.buffer) {
+		st.buffer = &registerThread();
+	}
+	st.current.id = nextTraceId.fetch_add(1, std::memory_order_relaxed);
+	std::unique_lock<std::mutex> lck{ st.buffer->mtx };
+	if (st.buffer->traces.size() < MaxBufferedTraces) {
+		st.buffer->traces.push_back(st.current);
+	}
+}
+
+Tracer::ThreadBuffer& Tracer::registerThread() {
+	auto buffer = std::make_unique<ThreadBuffer>();
+	std::unique_lock<std::mutex> lck{ buffersMtx };
+	buffer->tid = buffers.size() + 1;
+	buffers.push_back(std::move(buffer));
+	return *buffers.back();
+}
+
+void Tracer::run() {
+	std::vector<Trace> traces;
+	while (running()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(options.flushIntervalMs));
+		flush(traces);
+	}
+	flush(traces);
+}
+
+void Tracer::flush(std::vector<Trace>& traces) {
+	std::unique_lock<std::mutex> lck{ buffersMtx };
+	for (auto& buffer : buffers) {
+		{
+			std::unique_lock<std::mutex> bufferLck{ buffer->mtx };
+			traces.swap(buffer->traces);
+		}
+		for (const auto& trace : traces) {
+			write(trace, buffer->tid);
+		}
+		traces.clear();
+	}
+	out.flush();
+}
+
+void Tracer::write(const Trace& trace, size_t tid) {
+	out << std::format("{{\"name\":\"{}\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":1,\"tid\":{},\"args\":{{\"trace\":{}}}}},\n",
+		trace.name, trace.startMcs, trace.endMcs - trace.startMcs, tid, trace.id);
+	for (size_t i = 0; i < trace.spansCnt; ++i) {
+		const auto& span = trace.spans[i];
+		out << std::format("{{\"name\":\"{}\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":1,\"tid\":{},\"args\":{{\"trace\":{}}}}},\n",
+			span.name, span.startMcs, span.endMcs - span.startMcs, tid, trace.id);
+	}
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "profiling.hpp"
+
+/*
+	Sampled per-request tracing.
+	While tracer is running, every request records its phase spans into fixed thread local storage,
+	at request end the trace is kept if request is sampled (every sampleEvery-th) or slower than threshold.
+	Kept traces go to per-thread buffers and are appended to file in Chrome trace format
+	(chrome://tracing, Perfetto) by background thread.
+	When tracer is stopped, spans only check one thread local flag.
+	Span names should be literals - only pointers to them are stored.
+*/
+class Tracer {
+public:
+	struct Options {
+		std::string path;
+		size_t sampleEvery = 100;
+		size_t thresholdMcs = 50000;
+		size_t flushIntervalMs = 1000;
+	};
+
+	static constexpr size_t MaxSpans = 64;
+	// kept traces per thread between flushes, newer are dropped
+	static constexpr size_t MaxBufferedTraces = 4096;
+
+	static Tracer& get();
+	~Tracer();
+
+	void start(Options options);
+	void stop();
+	inline bool running() const { return isRunning.load(std::memory_order_relaxed); }
+
+	void beginRequest(const char* name);
+	void endRequest();
+	// adds span to current request, if it is traced
+	inline void span(const char* name, size_t startMcs, size_t endMcs);
+	// true if current request is traced
+	inline bool active() const;
+
+private:
+	struct Span {
+		const char* name;
+		size_t startMcs;
+		size_t endMcs;
+	};
+
+	struct Trace {
+		size_t id = 0;
+		const char* name = nullptr;
+		size_t startMcs = 0;
+		size_t endMcs = 0;
+		size_t spansCnt = 0;
+		std::array<Span, MaxSpans> spans;
+	};
+
+	struct ThreadBuffer {
+		size_t tid = 0;
+		std::mutex mtx;
+		std::vector<Trace> traces;
+	};
+
+	struct ThreadState {
+		bool active = false;
+		size_t requests = 0;
+		Trace current;
+		ThreadBuffer* buffer = nullptr;
+	};
+
+	Tracer() = default;
+	static inline ThreadState& state();
+	ThreadBuffer& registerThread();
+	void run();
+	void flush(std::vector<Trace>& traces);
+	void write(const Trace& trace, size_t tid);
+
+	Options options;
+	std::atomic<bool> isRunning{ false };
+	std::atomic<size_t> nextTraceId{ 1 };
+	std::mutex buffersMtx;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+	std::ofstream out;
+	std::thread flusher;
+};
+
+// records span of enclosing scope into current request trace
+class TraceSpan {
+public:
+	inline TraceSpan(const char* name) : name{ name }, startMcs{ Tracer::get().active() ? util::prof::tsMcs() : 0 } {}
+	inline ~TraceSpan() { if (startMcs) Tracer::get().span(name, startMcs, util::prof::tsMcs()); }
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+private:
+	const char* name;
+	size_t startMcs;
+};
+
+// traces enclosing scope as one request
+class TraceRequest {
+public:
+	inline TraceRequest(const char* name) { if (Tracer::get().running()) { Tracer::get().beginRequest(name); } }
+	inline ~TraceRequest() { if (Tracer::get().active()) { Tracer::get().endRequest(); } }
+	TraceRequest(const TraceRequest&) = delete;
+	TraceRequest& operator=(const TraceRequest&) = delete;
+};
+
+inline Tracer::ThreadState& Tracer::state() {
+	thread_local ThreadState threadState;
+	return threadState;
+}
+
+inline bool Tracer::active() const {
+	return state().active;
+}
+
+inline void Tracer::span(const char* name, size_t startMcs, size_t endMcs) {
+	auto& st = state();
+	if (st.active && (st.current.spansCnt < MaxSpans)) {
+		st.current.spans[st.current.spansCnt++] = { name, startMcs, endMcs };
+	}
+}
@@ -0,0 +1,90 @@
+#include "UploadSink.hpp"
+#include <atomic>
+#include <format>
+#include <openssl/evp.h>
+#include "profiling.hpp"
+
+namespace {
+
+	std::atomic<size_t> uploadsCnt{ 0 };
+
+}
+
+UploadSink::UploadSink(const std::filesystem::path& _dir, size_t _maxSize)
+	: dir{ _dir }, maxSize{ _maxSize }
+{
+	std::filesystem::create_directories(dir);
+	// leading dot - temp files are not served by name
+	tmpPath = dir / std::format(".upload-{}-{}.tmp", util::prof::tsMcs(), uploadsCnt.fetch_add(1, std::memory_order_relaxed));
+	out.open(tmpPath, std::ios::binary | std::ios::trunc);
+	hashCtx = EVP_MD_CTX_new();
+	failed = !out || !hashCtx || (EVP_DigestInit_ex(hashCtx, EVP_sha256(), nullptr) != 1);
+}
+
+UploadSink::~UploadSink() {
+	if (!committed) {
+		discard();
+	}
+	EVP_MD_CTX_free(hashCtx);
+}
+
+UploadSink::Status UploadSink::write(std::string_view chunk) {
+	if (failed) {
+		return Status::IoError;
+	}
+	if (written + chunk.size() > maxSize) {
+		failed = true;
+		discard();
+		return Status::TooLarge;
+	}
+	out.write(chunk.data(), chunk.size());
+	if (!out || (EVP_DigestUpdate(hashCtx, chunk.data(), chunk.size()) != 1)) {
+		failed = true;
+		discard();
+		return Status::IoError;
+	}
+	written += chunk.size();
+	return Status::Ok;
+}
+
+std::optional<std::string> UploadSink::finish() {
+	if (failed || committed || !out.is_open()) {
+		return std::nullopt;
+	}
+	out.close();
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digestSize = 0;
+	if (!out || (EVP_DigestFinal_ex(hashCtx, digest, &digestSize) != 1)) {
+		failed = true;
+		discard();
+		return std::nullopt;
+	}
+	std::string hash;
+	for (unsigned int i = 0; i < digestSize; ++i) {
+		hash += std::format("{:02x}", digest[i]);
+	}
+	return hash;
+}
+
+bool UploadSink::commit(const std::filesystem::path& target) {
+	if (failed || committed || out.is_open()) {
+		return false;
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, target, ec);
+	if (ec) {
+		failed = true;
+		discard();
+		return false;
+	}
+	committed = true;
+	return true;
+}
+
+void UploadSink::discard() {
+	if (out.is_open()) {
+		out.close();
+	}
+	std::error_code ec;
+	std::filesystem::remove(tmpPath, ec);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+struct evp_md_ctx_st;
+
+/*
+	Receives upload body chunk by chunk: every chunk is appended to temp file in storage directory
+	and added to running sha256, sink itself keeps no chunks.
+	Commit renames temp file to target path, rename in one filesystem is atomic, so readers
+	never see partial files. Not committed temp file is removed in destructor.
+	HttpServer hands body over only when it is received completely, so for now the whole upload
+	is in memory before first write(); sink is ready for body delivered in parts.
+*/
+class UploadSink {
+public:
+	enum class Status {
+		Ok,
+		TooLarge,
+		IoError
+	};
+
+	UploadSink(const std::filesystem::path& dir, size_t maxSize);
+	~UploadSink();
+	UploadSink(const UploadSink&) = delete;
+	UploadSink& operator=(const UploadSink&) = delete;
+
+	Status write(std::string_view chunk);
+	// ends upload, returns hex sha256 of content; nullopt on error
+	std::optional<std::string> finish();
+	// moves finished upload to target, which should be in the same filesystem as dir
+	bool commit(const std::filesystem::path& target);
+	// drops finished upload, e.g. when equal file is already stored
+	void discard();
+	inline size_t size() const { return written; }
+
+private:
+	const std::filesystem::path dir;
+	const size_t maxSize;
+	std::filesystem::path tmpPath;
+	std::ofstream out;
+	evp_md_ctx_st* hashCtx = nullptr;
+	size_t written = 0;
+	bool failed = false;
+	bool committed = false;
+};
@@ -1,7 +1,13 @@
+#include <cstdlib>
+#include <format>
+#include <stdexcept>
 #include "ProjLogger.hpp"
+#include "AsyncLog.hpp"
+#include "Tracing.hpp"
 #include "TcpServer.hpp"
 #include "test/testHttp.hpp"
 #include "MessengerDb.hpp"
+#include "MetricsServer.hpp"
 #include "Api.hpp"
 
 using namespace std;
@@ -10,6 +16,10 @@ using namespace util::web::http;
 
 static constexpr char CertPath[] = "/opt/chat/tls.crt";
 static constexpr char KeyPath[] = "/opt/chat/tls.key";
+static constexpr char IndexDir[] = "/opt/chat/index";
+static constexpr char ChangeLogDir[] = "/opt/chat/changes";
+// Prometheus scrapes it on 127.0.0.1 only
+static constexpr uint16_t MetricsPort = 9100;
 
 inet::SslTcpNonblockingSocket::SslCtx inet::SslTcpNonblockingSocket::ctx(CertPath, KeyPath);
 
@@ -17,9 +27,24 @@ int main(int argc, char* argv[])
 {
     assert(argc == 2);
     initLogger(LogLevel::debug);
+    AsyncLog::get().start(AsyncLog::Policy::Drop);
+    if (const char* tracePath = std::getenv("MESSENGER_TRACE_FILE"); tracePath) {
+        Tracer::Options traceOptions;
+        traceOptions.path = tracePath;
+        Tracer::get().start(traceOptions);
+    }
     
     auto pdb = std::make_unique<db::MessengerDb>("tcp://127.0.0.1:3306", "onyazuka", "5051", "messenger");
-    Api api(std::move(pdb));
+    Api api(std::move(pdb), IndexDir, std::filesystem::path(argv[1]) / "storage", ChangeLogDir);
+    // "<nodeId>@<socket path of node 0>,<socket path of node 1>,..."
+    if (const char* cluster = std::getenv("MESSENGER_CLUSTER"); cluster) {
+        auto optConfig = ClusterBus::parseConfig(cluster);
+        if (!optConfig.has_value()) {
+            throw std::runtime_error(std::format("invalid MESSENGER_CLUSTER: {}", cluster));
+        }
+        api.startCluster(optConfig->first, std::move(optConfig->second));
+    }
+    MetricsServer metricsServer(MetricsPort);
 
     HttpServer::get().setRoot(argv[1]);
 